@@ -0,0 +1,812 @@
+/* Wheel-of-Fortune Memory Allocator - workload benchmarks
+ *
+ * Runs a handful of workloads modelled on packet dissection against the
+ * allocator and a few points of comparison, and reports for each pair:
+ *  - ns/op:   wall-clock time per allocator call
+ *  - peak:    peak resident memory over the process baseline, in KB
+ *  - end:     resident memory over the baseline once the workload is done
+ *  - frag:    peak resident memory divided by the peak number of live
+ *             requested bytes (1.00 would be perfect)
+ *  - moved:   the share of reallocs that grew a buffer and had to move it to
+ *             do so, for the workloads that grow buffers
+ *
+ * Every pair runs in a child process of its own, so that the RSS figures of
+ * one do not leak into the next. RSS is read from /proc, so this is
+ * Linux-only.
+ *
+ * Build with `make wof_bench` (or `make wof_bench_mmap`, for blocks mapped
+ * straight from the OS), which comes down to something like:
+ *
+ *   cc -O2 -I.. -o wof_bench wof_bench.c ../wof_allocator.c
+ *
+ * and run with:
+ *
+ *   ./wof_bench [scale]
+ *
+ * where scale (default 1) multiplies the amount of work each workload does.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "wof_allocator_inline.h"
+
+/* ALLOCATORS UNDER TEST */
+
+typedef struct {
+    const char *name;
+    void *(*create)(void);
+    void  (*destroy)(void *ctx);
+    void *(*alloc)(void *ctx, size_t size);
+    void  (*free)(void *ctx, void *ptr);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);
+    /* NULL if the allocator has no way to free everything at once, in which
+     * case the workload frees what it has outstanding one at a time */
+    void  (*free_all)(void *ctx);
+    void  (*gc)(void *ctx);
+} bench_allocator_t;
+
+static void *
+wof_create(void)
+{
+    return wof_allocator_new();
+}
+
+static void *
+wof_small_create(void)
+{
+    return wof_allocator_new_flags(WOF_FLAG_SMALL_OBJECTS);
+}
+
+static void *
+wof_tlsf_create(void)
+{
+    return wof_allocator_new_flags(WOF_FLAG_TLSF_INDEX);
+}
+
+static void
+wof_destroy(void *ctx)
+{
+    wof_allocator_destroy((wof_allocator_t *)ctx);
+}
+
+static void *
+wof_b_alloc(void *ctx, size_t size)
+{
+    return wof_alloc((wof_allocator_t *)ctx, size);
+}
+
+static void *
+wof_b_alloc_inline(void *ctx, size_t size)
+{
+    return wof_alloc_inline((wof_allocator_t *)ctx, size);
+}
+
+static void
+wof_b_free(void *ctx, void *ptr)
+{
+    wof_free((wof_allocator_t *)ctx, ptr);
+}
+
+static void *
+wof_b_realloc(void *ctx, void *ptr, size_t size)
+{
+    return wof_realloc((wof_allocator_t *)ctx, ptr, size);
+}
+
+/* A realloc that never slides into the chunk to its left: it grows into the
+ * right-hand neighbour if it can, and otherwise moves, as wof_realloc did
+ * before it learned to slide. For comparing how often grows have to move. */
+static void *
+wof_b_realloc_right(void *ctx, void *ptr, size_t size)
+{
+    wof_allocator_t *allocator = (wof_allocator_t *)ctx;
+    void            *new_ptr;
+    size_t           old_size;
+
+    if (ptr == NULL) {
+        return wof_alloc(allocator, size);
+    }
+
+    new_ptr = wof_realloc_try_in_place(allocator, ptr, size);
+    if (new_ptr) {
+        return new_ptr;
+    }
+
+    old_size = WOF_CHUNK_DATA_LEN(WOF_DATA_TO_CHUNK(ptr));
+    new_ptr  = wof_alloc(allocator, size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        wof_free(allocator, ptr);
+    }
+    return new_ptr;
+}
+
+static void
+wof_b_free_all(void *ctx)
+{
+    wof_free_all((wof_allocator_t *)ctx);
+}
+
+static void
+wof_b_gc(void *ctx)
+{
+    wof_gc((wof_allocator_t *)ctx);
+}
+
+static void *
+sys_create(void)
+{
+    return NULL;
+}
+
+static void
+sys_destroy(void *ctx)
+{
+    (void)ctx;
+}
+
+static void *
+sys_alloc(void *ctx, size_t size)
+{
+    (void)ctx;
+    return malloc(size);
+}
+
+static void
+sys_free(void *ctx, void *ptr)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+static void *
+sys_realloc(void *ctx, void *ptr, size_t size)
+{
+    (void)ctx;
+    return realloc(ptr, size);
+}
+
+static void
+sys_gc(void *ctx)
+{
+    (void)ctx;
+}
+
+/* A plain bump allocator over 8MB chunks, with a size word in front of each
+ * allocation so that it can realloc. free is a no-op; free_all rewinds to the
+ * first chunk and gc releases every chunk but that one. */
+
+#define BUMP_CHUNK_SIZE (8 * 1024 * 1024)
+
+typedef struct bump_chunk {
+    struct bump_chunk *next;
+    size_t             size;
+    size_t             used;
+} bump_chunk_t;
+
+typedef struct {
+    bump_chunk_t *first;
+    bump_chunk_t *current;
+} bump_t;
+
+static void *
+bump_create(void)
+{
+    bump_t *bump = (bump_t *)calloc(1, sizeof(bump_t));
+    return bump;
+}
+
+static void
+bump_destroy(void *ctx)
+{
+    bump_t       *bump = (bump_t *)ctx;
+    bump_chunk_t *chunk, *next;
+
+    for (chunk = bump->first; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    free(bump);
+}
+
+static void *
+bump_alloc(void *ctx, size_t size)
+{
+    bump_t       *bump = (bump_t *)ctx;
+    bump_chunk_t *chunk;
+    size_t        need, chunk_size;
+    size_t       *ptr;
+
+    need = (sizeof(size_t) * 2 + size + 15) & ~(size_t)15;
+
+    chunk = bump->current;
+    while (chunk && chunk->used + need > chunk->size) {
+        chunk = chunk->next;
+    }
+
+    if (chunk == NULL) {
+        chunk_size = need > BUMP_CHUNK_SIZE - 64 ? need + 64 : BUMP_CHUNK_SIZE;
+        chunk = (bump_chunk_t *)malloc(chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = chunk_size;
+        chunk->used = 64;
+        chunk->next = NULL;
+        if (bump->current) {
+            chunk->next = bump->current->next;
+            bump->current->next = chunk;
+        }
+        else {
+            bump->first = chunk;
+        }
+    }
+
+    bump->current = chunk;
+    ptr = (size_t *)((unsigned char *)chunk + chunk->used);
+    chunk->used += need;
+    ptr[0] = size;
+
+    return ptr + 2;
+}
+
+static void
+bump_free(void *ctx, void *ptr)
+{
+    (void)ctx;
+    (void)ptr;
+}
+
+static void *
+bump_realloc(void *ctx, void *ptr, size_t size)
+{
+    void   *new_ptr;
+    size_t  old_size;
+
+    if (ptr == NULL) {
+        return bump_alloc(ctx, size);
+    }
+
+    old_size = ((size_t *)ptr)[-2];
+    if (size <= old_size) {
+        return ptr;
+    }
+
+    new_ptr = bump_alloc(ctx, size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, old_size);
+    }
+    return new_ptr;
+}
+
+static void
+bump_free_all(void *ctx)
+{
+    bump_t       *bump = (bump_t *)ctx;
+    bump_chunk_t *chunk;
+
+    for (chunk = bump->first; chunk; chunk = chunk->next) {
+        chunk->used = 64;
+    }
+    bump->current = bump->first;
+}
+
+static void
+bump_gc(void *ctx)
+{
+    bump_t       *bump = (bump_t *)ctx;
+    bump_chunk_t *chunk, *next;
+
+    if (bump->first == NULL) {
+        return;
+    }
+
+    for (chunk = bump->first->next; chunk; chunk = next) {
+        next = chunk->next;
+        if (chunk->used == 64) {
+            free(chunk);
+        }
+        else {
+            /* still in use, so everything must be kept */
+            return;
+        }
+    }
+    bump->first->next = NULL;
+    bump->current = bump->first;
+}
+
+static const bench_allocator_t allocators[] = {
+    { "wof", wof_create, wof_destroy, wof_b_alloc, wof_b_free,
+        wof_b_realloc, wof_b_free_all, wof_b_gc },
+    { "wof+inline", wof_create, wof_destroy, wof_b_alloc_inline, wof_b_free,
+        wof_b_realloc, wof_b_free_all, wof_b_gc },
+    { "wof+right", wof_create, wof_destroy, wof_b_alloc, wof_b_free,
+        wof_b_realloc_right, wof_b_free_all, wof_b_gc },
+    { "wof+small", wof_small_create, wof_destroy, wof_b_alloc, wof_b_free,
+        wof_b_realloc, wof_b_free_all, wof_b_gc },
+    { "wof+tlsf", wof_tlsf_create, wof_destroy, wof_b_alloc, wof_b_free,
+        wof_b_realloc, wof_b_free_all, wof_b_gc },
+    { "malloc", sys_create, sys_destroy, sys_alloc, sys_free,
+        sys_realloc, NULL, sys_gc },
+    { "bump", bump_create, bump_destroy, bump_alloc, bump_free,
+        bump_realloc, bump_free_all, bump_gc },
+};
+
+#define N_ALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+/* WORKLOAD HELPERS */
+
+typedef struct {
+    const bench_allocator_t *a;
+    void                    *ctx;
+    unsigned long            ops;
+    size_t                   live;
+    size_t                   peak_live;
+    /* reallocs that grew a buffer, and how many of those moved it */
+    unsigned long            grows;
+    unsigned long            moved;
+    /* everything allocated since the last free_all, for allocators that
+     * cannot free it all at once */
+    void                   **outstanding;
+    size_t                   n_outstanding;
+    size_t                   max_outstanding;
+} bench_t;
+
+static unsigned long rng_state = 1;
+
+static unsigned long
+rng(void)
+{
+    rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+    return rng_state >> 33;
+}
+
+/* Sizes typical of dissection: mostly tree nodes and short strings, with the
+ * odd reassembly buffer. */
+static size_t
+dissect_size(void)
+{
+    unsigned long r = rng() % 100;
+
+    if (r < 60) {
+        return 16 + rng() % 48;
+    }
+    else if (r < 90) {
+        return 64 + rng() % 192;
+    }
+    else if (r < 99) {
+        return 256 + rng() % 1792;
+    }
+    return 2048 + rng() % 14336;
+}
+
+static void
+track_live(bench_t *b, long delta)
+{
+    b->live += delta;
+    if (b->live > b->peak_live) {
+        b->peak_live = b->live;
+    }
+}
+
+static void *
+b_alloc(bench_t *b, size_t size)
+{
+    void *ptr;
+
+    ptr = b->a->alloc(b->ctx, size);
+    memset(ptr, 0xa5, size < 64 ? size : 64);
+    b->ops++;
+    track_live(b, (long)size);
+
+    if (b->a->free_all == NULL) {
+        if (b->n_outstanding == b->max_outstanding) {
+            b->max_outstanding = b->max_outstanding
+                ? b->max_outstanding * 2
+                : 1024;
+            b->outstanding = (void **)realloc(b->outstanding,
+                    b->max_outstanding * sizeof(void *));
+        }
+        b->outstanding[b->n_outstanding++] = ptr;
+    }
+
+    return ptr;
+}
+
+/* reallocs a buffer, counting the grows that had to move it; the new pointer
+ * does not go on the outstanding list, so the workload must free it itself
+ * unless the allocator has free_all */
+static void *
+b_realloc(bench_t *b, void *ptr, size_t old_size, size_t size)
+{
+    void *new_ptr;
+
+    new_ptr = b->a->realloc(b->ctx, ptr, size);
+    b->ops++;
+    track_live(b, (long)size - (long)old_size);
+
+    if (ptr && size > old_size) {
+        b->grows++;
+        if (new_ptr != ptr) {
+            b->moved++;
+        }
+    }
+
+    return new_ptr;
+}
+
+/* frees something allocated by b_alloc, for workloads that only free some
+ * of their allocations individually and leave the rest to free_all */
+static void
+b_free_tracked(bench_t *b, void **slot, size_t size)
+{
+    if (b->a->free_all == NULL) {
+        /* leave it for the outstanding list, which will free it */
+        return;
+    }
+    b->a->free(b->ctx, *slot);
+    *slot = NULL;
+    b->ops++;
+    track_live(b, -(long)size);
+}
+
+static void
+b_free_all(bench_t *b)
+{
+    size_t i;
+
+    if (b->a->free_all) {
+        b->a->free_all(b->ctx);
+        b->ops++;
+    }
+    else {
+        for (i = 0; i < b->n_outstanding; i++) {
+            b->a->free(b->ctx, b->outstanding[i]);
+            b->ops++;
+        }
+        b->n_outstanding = 0;
+    }
+    b->live = 0;
+}
+
+/* WORKLOADS */
+
+static unsigned long scale = 1;
+
+/* Fixed-size, short-lived allocations: a sliding window of 64-byte objects,
+ * each freed a thousand allocations after it was made. */
+static void
+workload_fixed(bench_t *b)
+{
+    void          *window[1024];
+    unsigned long  i, n;
+    size_t         slot;
+
+    memset(window, 0, sizeof(window));
+    n = 2000000 * scale;
+
+    for (i = 0; i < n; i++) {
+        slot = i % 1024;
+        if (window[slot]) {
+            b->a->free(b->ctx, window[slot]);
+            b->ops++;
+            track_live(b, -64);
+        }
+        window[slot] = b->a->alloc(b->ctx, 64);
+        memset(window[slot], 0, 64);
+        b->ops++;
+        track_live(b, 64);
+    }
+
+    for (slot = 0; slot < 1024; slot++) {
+        b->a->free(b->ctx, window[slot]);
+    }
+}
+
+/* Variable-sized realloc storm: 256 buffers, each repeatedly resized to a
+ * size between 16 bytes and 64KB (log-uniformly distributed). */
+static void
+workload_realloc(bench_t *b)
+{
+    void          *bufs[256];
+    size_t         sizes[256];
+    unsigned long  i, n;
+    size_t         k, size;
+
+    memset(bufs, 0, sizeof(bufs));
+    memset(sizes, 0, sizeof(sizes));
+    n = 500000 * scale;
+
+    for (i = 0; i < n; i++) {
+        k = rng() % 256;
+        size = (size_t)16 << (rng() % 12);
+        size += rng() % size;
+        bufs[k] = b_realloc(b, bufs[k], sizes[k], size);
+        memset(bufs[k], 0, size < 64 ? size : 64);
+        sizes[k] = size;
+    }
+
+    for (k = 0; k < 256; k++) {
+        b->a->free(b->ctx, bufs[k]);
+    }
+}
+
+/* Wireshark-style dissection: each packet makes a few hundred allocations of
+ * typical sizes, grows a few label strings, frees a few things explicitly,
+ * and then everything is thrown away with free_all. */
+static void
+workload_dissect(bench_t *b)
+{
+    void          *objs[600];
+    size_t         sizes[600];
+    unsigned long  p, n;
+    size_t         i, count, len;
+
+    n = 20000 * scale;
+
+    for (p = 0; p < n; p++) {
+        count = 200 + rng() % 400;
+
+        for (i = 0; i < count; i++) {
+            sizes[i] = dissect_size();
+            objs[i]  = b_alloc(b, sizes[i]);
+
+            if (i % 50 == 0 && b->a->free_all) {
+                /* a label that gets appended to a few times */
+                for (len = 32; len <= 256; len *= 2) {
+                    objs[i] = b_realloc(b, objs[i], sizes[i], len);
+                    sizes[i] = len;
+                }
+            }
+
+            if (i > 0 && rng() % 10 == 0 && objs[i - 1]) {
+                b_free_tracked(b, &objs[i - 1], sizes[i - 1]);
+            }
+        }
+
+        b_free_all(b);
+    }
+}
+
+/* Growable label buffers: each packet keeps eight labels, which are appended
+ * to (by 8 to 48 bytes at a time, up to 2KB) in among a few hundred
+ * allocations of typical sizes, some of which are freed again. The labels are
+ * freed at the end of the packet, and everything else with free_all. */
+static void
+workload_labels(bench_t *b)
+{
+    void          *objs[600];
+    size_t         sizes[600];
+    char          *labels[8];
+    size_t         lens[8];
+    unsigned long  p, n;
+    size_t         i, k, count, add;
+
+    n = 20000 * scale;
+
+    for (p = 0; p < n; p++) {
+        for (k = 0; k < 8; k++) {
+            lens[k]   = 16;
+            labels[k] = (char *)b->a->alloc(b->ctx, lens[k]);
+            memset(labels[k], 'a', lens[k]);
+            b->ops++;
+            track_live(b, (long)lens[k]);
+        }
+
+        count = 200 + rng() % 400;
+
+        for (i = 0; i < count; i++) {
+            sizes[i] = dissect_size();
+            objs[i]  = b_alloc(b, sizes[i]);
+
+            if (i % 4 == 0) {
+                k   = rng() % 8;
+                add = 8 + rng() % 41;
+                if (lens[k] + add <= 2048) {
+                    labels[k] = (char *)b_realloc(b, labels[k], lens[k],
+                            lens[k] + add);
+                    memset(labels[k] + lens[k], 'a', add);
+                    lens[k] += add;
+                }
+            }
+
+            if (i > 0 && rng() % 10 == 0 && objs[i - 1]) {
+                b_free_tracked(b, &objs[i - 1], sizes[i - 1]);
+            }
+        }
+
+        for (k = 0; k < 8; k++) {
+            b->a->free(b->ctx, labels[k]);
+            b->ops++;
+            track_live(b, -(long)lens[k]);
+        }
+
+        b_free_all(b);
+    }
+}
+
+/* Bursts: every so often a burst allocates 64MB in dissection-sized pieces,
+ * after which everything is freed and gc is called. Between bursts, a quiet
+ * period of small packets runs. */
+static void
+workload_gc(bench_t *b)
+{
+    unsigned long burst, n, p;
+    size_t        total, i;
+
+    n = 20 * scale;
+
+    for (burst = 0; burst < n; burst++) {
+        for (total = 0; total < 64 * 1024 * 1024; ) {
+            i = dissect_size();
+            b_alloc(b, i);
+            total += i;
+        }
+        b_free_all(b);
+        b->a->gc(b->ctx);
+        b->ops++;
+
+        for (p = 0; p < 1000; p++) {
+            for (i = 0; i < 50; i++) {
+                b_alloc(b, dissect_size());
+            }
+            b_free_all(b);
+        }
+    }
+
+    b->a->gc(b->ctx);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(bench_t *b);
+} workload_t;
+
+static const workload_t workloads[] = {
+    { "fixed",    workload_fixed },
+    { "realloc",  workload_realloc },
+    { "dissect",  workload_dissect },
+    { "labels",   workload_labels },
+    { "gc-burst", workload_gc },
+};
+
+#define N_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/* DRIVER */
+
+/* Reads a "Vm...:" line from /proc/self/status, in KB. */
+static long
+status_kb(const char *field)
+{
+    FILE   *f;
+    char    line[128];
+    long    kb = 0;
+    size_t  len = strlen(field);
+
+    f = fopen("/proc/self/status", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            kb = strtol(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+
+    return kb;
+}
+
+/* Resets the peak RSS (VmHWM) of the process to its current RSS. */
+static void
+reset_peak_rss(void)
+{
+    FILE *f;
+
+    f = fopen("/proc/self/clear_refs", "w");
+    if (f) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+/* Runs in the child: does the work and writes the results down the pipe. */
+static void
+run_child(const workload_t *w, const bench_allocator_t *a, int fd)
+{
+    bench_t          b;
+    struct timespec  start, end;
+    double           results[5];
+    long             base;
+
+    memset(&b, 0, sizeof(b));
+    b.a   = a;
+    b.ctx = a->create();
+    rng_state = 1;
+
+    reset_peak_rss();
+    base = status_kb("VmRSS");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    w->run(&b);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    results[0] = ((end.tv_sec - start.tv_sec) * 1e9 +
+            (end.tv_nsec - start.tv_nsec)) / (double)b.ops;
+    results[1] = (double)(status_kb("VmHWM") - base);
+    results[2] = (double)(status_kb("VmRSS") - base);
+    results[3] = (double)b.peak_live;
+    results[4] = b.grows ? 100.0 * b.moved / b.grows : -1;
+
+    if (write(fd, results, sizeof(results)) != sizeof(results)) {
+        _exit(1);
+    }
+
+    a->destroy(b.ctx);
+    _exit(0);
+}
+
+int
+main(int argc, char **argv)
+{
+    double        results[5];
+    size_t        w, a;
+    int           fds[2], status;
+    pid_t         pid;
+
+    if (argc > 1) {
+        scale = strtoul(argv[1], NULL, 10);
+    }
+
+    printf("%-10s %-10s %10s %10s %10s %7s %7s\n",
+            "workload", "allocator", "ns/op", "peak KB", "end KB", "frag",
+            "moved");
+
+    for (w = 0; w < N_WORKLOADS; w++) {
+        for (a = 0; a < N_ALLOCATORS; a++) {
+            if (pipe(fds) != 0) {
+                return 1;
+            }
+
+            fflush(stdout);
+            pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                run_child(&workloads[w], &allocators[a], fds[1]);
+            }
+            close(fds[1]);
+
+            if (read(fds[0], results, sizeof(results)) != sizeof(results)) {
+                fprintf(stderr, "%s/%s failed\n", workloads[w].name,
+                        allocators[a].name);
+                close(fds[0]);
+                waitpid(pid, &status, 0);
+                continue;
+            }
+            close(fds[0]);
+
+            waitpid(pid, &status, 0);
+
+            printf("%-10s %-10s %10.1f %10.0f %10.0f %7.2f",
+                    workloads[w].name, allocators[a].name, results[0],
+                    results[1], results[2],
+                    results[3] > 0 ? results[1] * 1024 / results[3] : 0.0);
+            if (results[4] >= 0) {
+                printf(" %6.0f%%\n", results[4]);
+            }
+            else {
+                printf(" %7s\n", "-");
+            }
+        }
+    }
+
+    return 0;
+}
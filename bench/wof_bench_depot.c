@@ -0,0 +1,140 @@
+/* Wheel-of-Fortune Memory Allocator - depot benchmark
+ *
+ * Runs a few threads, each of which over and over creates a pool of 1MB
+ * blocks, fills two of its blocks (writing to every byte) and destroys it
+ * again, as a program that makes a pool per connection or per job would. The
+ * pools either get their blocks straight from the OS, or all share a single
+ * wof_depot_t in front of it. Reports the time per pool and the page faults
+ * the process took per pool; with the depot the blocks come back already
+ * faulted in, so after the first few pools there should be hardly any.
+ *
+ * The depot is only shared between threads with WOF_THREADS, and the page
+ * faults only show up with blocks from the OS, so build with both, as
+ * `make wof_bench_depot` does:
+ *
+ *   cc -O2 -DWOF_THREADS -DWOF_USE_MMAP -I.. -o wof_bench_depot \
+ *       wof_bench_depot.c ../wof_allocator.c -lpthread
+ *
+ *   ./wof_bench_depot [threads] [pools per thread]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "wof_allocator.h"
+
+#define BLOCK_SIZE (1024 * 1024)
+#define CHUNK_SIZE (64 * 1024)
+
+static wof_depot_t depot;
+static int         use_depot;
+static long        pools_per_thread = 2000;
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long
+page_faults(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+static void *
+worker(void *arg)
+{
+    wof_allocator_options_t options;
+    wof_allocator_t        *pool;
+    wof_allocator_stats_t   stats;
+    char                   *ptr;
+    long                    i;
+
+    (void)arg;
+
+    wof_allocator_options_init(&options);
+    options.block_size = BLOCK_SIZE;
+    if (use_depot) {
+        options.source     = &wof_depot_source;
+        options.source_ctx = &depot;
+    }
+
+    for (i = 0; i < pools_per_thread; i++) {
+        pool = wof_allocator_new_ex(&options);
+
+        do {
+            ptr = (char *)wof_alloc(pool, CHUNK_SIZE);
+            memset(ptr, 0x5a, CHUNK_SIZE);
+            wof_allocator_stats(pool, &stats);
+        } while (stats.blocks < 2 || stats.largest_free >= CHUNK_SIZE);
+
+        wof_allocator_destroy(pool);
+    }
+
+    return NULL;
+}
+
+static void
+run(const char *name, const int threads)
+{
+    pthread_t *tids;
+    double     start;
+    long       faults;
+    int        i;
+
+    tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+
+    faults = page_faults();
+    start  = now_ns();
+    for (i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, worker, NULL);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    printf("%-12s %12.1f %16.1f\n", name,
+            (now_ns() - start) / 1000 / (threads * pools_per_thread),
+            (double)(page_faults() - faults) / (threads * pools_per_thread));
+
+    free(tids);
+}
+
+int
+main(int argc, char **argv)
+{
+    int threads = 4;
+
+    if (argc > 1) {
+        threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        pools_per_thread = atol(argv[2]);
+    }
+
+    printf("%-12s %12s %16s\n", "", "us/pool", "page faults/pool");
+
+    use_depot = 0;
+    run("OS source", threads);
+
+    /* room for every thread's pool to hand back both its blocks */
+    wof_depot_init(&depot, BLOCK_SIZE, 2 * threads, NULL, NULL);
+    use_depot = 1;
+    run("shared depot", threads);
+    wof_depot_drain(&depot);
+
+    return 0;
+}
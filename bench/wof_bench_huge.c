@@ -0,0 +1,108 @@
+/* Wheel-of-Fortune Memory Allocator - huge page benchmark
+ *
+ * Fills a pool of 128MB blocks with 1000-byte objects, 1GB of them by default,
+ * and then reads one word from each of a few million objects picked at
+ * random, and reports the mean time per read. It does so on a pool created
+ * with WOF_FLAG_HUGE_PAGES and on one without, so the difference is what the
+ * TLB misses cost. Transparent huge pages have to be enabled (at least for
+ * madvise) for the flag to make a difference.
+ *
+ * The flag only applies to blocks mapped straight from the OS, so build with
+ * WOF_USE_MMAP, as `make wof_bench_huge` does:
+ *
+ *   cc -O2 -DWOF_USE_MMAP -I.. -o wof_bench_huge wof_bench_huge.c \
+ *       ../wof_allocator.c
+ *
+ *   ./wof_bench_huge [MB]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wof_allocator.h"
+
+#define OBJ_SIZE   1000
+#define BLOCK_SIZE (128 * 1024 * 1024)
+#define READS      (4 * 1024 * 1024)
+
+static unsigned long rng_state;
+
+/* where the reads go, so that they are not optimized away */
+static volatile size_t sink;
+
+static unsigned long
+rng(void)
+{
+    rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+    return (unsigned long)(rng_state >> 33);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+run(const char *name, const unsigned int flags, size_t n)
+{
+    wof_allocator_options_t options;
+    wof_allocator_t        *pool;
+    size_t                **objs;
+    size_t                  i, sum = 0;
+    double                  start;
+
+    wof_allocator_options_init(&options);
+    options.block_size = BLOCK_SIZE;
+    options.flags      = flags;
+    pool = wof_allocator_new_ex(&options);
+
+    objs = (size_t **)malloc(n * sizeof(size_t *));
+
+    for (i = 0; i < n; i++) {
+        objs[i] = (size_t *)wof_alloc(pool, OBJ_SIZE);
+        if (objs[i] == NULL) {
+            fprintf(stderr, "wof_alloc failed after %lu objects\n",
+                    (unsigned long)i);
+            exit(1);
+        }
+        memset(objs[i], (int)i, OBJ_SIZE);
+    }
+
+    rng_state = 1;
+    start = now_ns();
+    for (i = 0; i < READS; i++) {
+        sum += *objs[rng() % n];
+    }
+
+    printf("%-20s %10.1f\n", name, (now_ns() - start) / READS);
+    sink = sum;
+
+    free(objs);
+    wof_allocator_destroy(pool);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t mb = 1024, n;
+
+    if (argc > 1) {
+        mb = strtoul(argv[1], NULL, 10);
+    }
+    n = mb * 1024 * 1024 / (OBJ_SIZE + 16);
+
+    printf("%-20s %10s\n", "", "ns/read");
+
+    run("4KB pages", 0, n);
+    run("WOF_FLAG_HUGE_PAGES", WOF_FLAG_HUGE_PAGES, n);
+
+    return 0;
+}
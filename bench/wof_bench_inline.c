@@ -0,0 +1,122 @@
+/* Wheel-of-Fortune Memory Allocator - inline fast path benchmark
+ *
+ * Times a tight loop of small allocations (24 to 56 bytes, with a
+ * wof_free_all every 1024 of them) made through wof_alloc and through
+ * wof_alloc_inline, and reports the mean time per allocation of each. The
+ * sizes are drawn up front, so the loop itself is little more than the
+ * allocation and a one-byte write to what it returns. The workloads in
+ * wof_bench.c do much more around each call, which hides most of the
+ * difference.
+ *
+ * Build with `make wof_bench_inline`, which comes down to:
+ *
+ *   cc -O2 -I.. -o wof_bench_inline wof_bench_inline.c ../wof_allocator.c
+ *
+ *   ./wof_bench_inline [millions of allocations]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "wof_allocator_inline.h"
+
+#define BATCH 1024
+
+static unsigned long rng_state = 1;
+
+static unsigned long
+rng(void)
+{
+    rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+    return (unsigned long)(rng_state >> 33);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double
+run_call(wof_allocator_t *pool, const size_t *sizes, unsigned long n)
+{
+    double        start;
+    unsigned long i;
+    size_t        j;
+    char         *ptr;
+
+    start = now_ns();
+    for (i = 0; i < n; i += BATCH) {
+        for (j = 0; j < BATCH; j++) {
+            ptr  = (char *)wof_alloc(pool, sizes[j]);
+            *ptr = (char)j;
+        }
+        wof_free_all(pool);
+    }
+
+    return (now_ns() - start) / n;
+}
+
+static double
+run_inline(wof_allocator_t *pool, const size_t *sizes, unsigned long n)
+{
+    double        start;
+    unsigned long i;
+    size_t        j;
+    char         *ptr;
+
+    start = now_ns();
+    for (i = 0; i < n; i += BATCH) {
+        for (j = 0; j < BATCH; j++) {
+            ptr  = (char *)wof_alloc_inline(pool, sizes[j]);
+            *ptr = (char)j;
+        }
+        wof_free_all(pool);
+    }
+
+    return (now_ns() - start) / n;
+}
+
+int
+main(int argc, char **argv)
+{
+    wof_allocator_t *pool;
+    size_t           sizes[BATCH];
+    unsigned long    n = 20;
+    size_t           j;
+    int              round;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+    n *= 1000000;
+
+    for (j = 0; j < BATCH; j++) {
+        sizes[j] = 24 + rng() % 33;
+    }
+
+    pool = wof_allocator_new();
+
+    /* warm up, so that both start with the block already faulted in */
+    run_call(pool, sizes, BATCH * 16);
+
+    printf("%-8s %12s %12s\n", "round", "call ns", "inline ns");
+
+    /* alternate, so that neither gets all the benefit of a quiet machine */
+    for (round = 1; round <= 3; round++) {
+        double call = run_call(pool, sizes, n);
+        double inl  = run_inline(pool, sizes, n);
+
+        printf("%-8d %12.2f %12.2f\n", round, call, inl);
+    }
+
+    wof_allocator_destroy(pool);
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+/* Wheel-of-Fortune Memory Allocator - jumbo growth benchmark
+ *
+ * Grows a single buffer, as a reassembled stream would, 64KB at a time up to
+ * 32MB with wof_realloc, writing to each new piece as it goes, and reports
+ * the total time. It does so twice: once on the pool's own mmap source, which
+ * resizes jumbo blocks with mremap where it can, and once on a source that
+ * only maps and unmaps, so that every step has to map a new block, copy the
+ * old one into it and unmap the old one.
+ *
+ * mremap only comes into it when blocks come straight from the OS, so build
+ * with WOF_USE_MMAP, as `make wof_bench_jumbo` does:
+ *
+ *   cc -O2 -DWOF_USE_MMAP -I.. -o wof_bench_jumbo wof_bench_jumbo.c \
+ *       ../wof_allocator.c
+ *
+ *   ./wof_bench_jumbo [MB]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "wof_allocator.h"
+
+#define STEP (64 * 1024)
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* A source of plain anonymous mappings, with no resize_block. */
+static void *
+map_get(void *ctx, const size_t size)
+{
+    void *ptr;
+
+    (void)ctx;
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static void
+map_release(void *ctx, void *block, const size_t size)
+{
+    (void)ctx;
+    munmap(block, size);
+}
+
+static const wof_block_source_t map_source = {
+    map_get,
+    map_release,
+    NULL,
+    NULL
+};
+
+static void
+run(const char *name, wof_allocator_t *pool, size_t total)
+{
+    double  start;
+    size_t  len;
+    char   *buf = NULL;
+
+    start = now_ns();
+    for (len = STEP; len <= total; len += STEP) {
+        buf = (char *)wof_realloc(pool, buf, len);
+        if (buf == NULL) {
+            fprintf(stderr, "wof_realloc failed at %lu bytes\n",
+                    (unsigned long)len);
+            exit(1);
+        }
+        memset(buf + len - STEP, 0x5a, STEP);
+    }
+
+    printf("%-22s %10.1f\n", name, (now_ns() - start) / 1e6);
+
+    wof_free(pool, buf);
+}
+
+int
+main(int argc, char **argv)
+{
+    wof_allocator_options_t options;
+    wof_allocator_t        *pool;
+    size_t                  total = 32;
+
+    if (argc > 1) {
+        total = strtoul(argv[1], NULL, 10);
+    }
+    total *= 1024 * 1024;
+
+    printf("%-22s %10s\n", "", "ms");
+
+    pool = wof_allocator_new();
+    run("mremap", pool, total);
+    wof_allocator_destroy(pool);
+
+    wof_allocator_options_init(&options);
+    options.source = &map_source;
+    pool = wof_allocator_new_ex(&options);
+    run("map, copy, unmap", pool, total);
+    wof_allocator_destroy(pool);
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+/* Wheel-of-Fortune Memory Allocator - C++ memory resource benchmark
+ *
+ * Runs per-packet container code (a vector that is appended to, a hash map
+ * with some inserts and erases, and a few strings) against a pool through
+ * wof::pool_resource (with and without the small-object layer and
+ * release-only mode) and wof::allocator<T>, and against the standard memory
+ * resources for comparison. Every packet's containers die at
+ * the end of the packet, after which the resource is released where that
+ * makes sense. Reports the wall-clock time per packet.
+ *
+ * Build with `make wof_bench_pmr`, or by hand with something like:
+ *
+ *   cc -O2 -c ../wof_allocator.c
+ *   c++ -O2 -std=c++17 -I.. -o wof_bench_pmr wof_bench_pmr.cpp wof_allocator.o
+ *   ./wof_bench_pmr [packets]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "wof_allocator.hpp"
+
+static unsigned long rng_state = 1;
+
+static unsigned long
+rng(void)
+{
+    rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+    return rng_state >> 33;
+}
+
+/* One packet's worth of work, with every container drawing from `mr`. */
+static unsigned long
+packet(std::pmr::memory_resource *mr)
+{
+    std::pmr::vector<int>                fields(mr);
+    std::pmr::unordered_map<int, int>    conv(mr);
+    std::pmr::vector<std::pmr::string>   labels(mr);
+    unsigned long                        i, n, sum = 0;
+
+    n = 100 + rng() % 200;
+
+    for (i = 0; i < n; i++) {
+        fields.push_back((int)rng());
+        conv[(int)(rng() % 512)] += 1;
+        if (i % 8 == 0) {
+            conv.erase((int)(rng() % 512));
+        }
+        if (i % 16 == 0) {
+            labels.emplace_back("a label long enough to need the heap");
+            labels.back().append(rng() % 64, 'x');
+        }
+    }
+
+    for (i = 0; i < labels.size(); i++) {
+        sum += labels[i].size();
+    }
+
+    return sum + fields.size() + conv.size();
+}
+
+/* The same packet through wof::allocator<T> and the ordinary containers. */
+static unsigned long
+packet_alloc(wof_allocator_t *pool)
+{
+    typedef wof::allocator<std::pair<const int, int> > map_alloc_t;
+
+    std::vector<int, wof::allocator<int> > fields{wof::allocator<int>(pool)};
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+        map_alloc_t> conv(16, std::hash<int>(), std::equal_to<int>(),
+                map_alloc_t(pool));
+    unsigned long i, n;
+
+    n = 100 + rng() % 200;
+
+    for (i = 0; i < n; i++) {
+        fields.push_back((int)rng());
+        conv[(int)(rng() % 512)] += 1;
+        if (i % 8 == 0) {
+            conv.erase((int)(rng() % 512));
+        }
+    }
+
+    return fields.size() + conv.size();
+}
+
+enum kind {
+    WOF, WOF_SMALL, WOF_RELEASE_ONLY, WOF_ALLOCATOR,
+    MONOTONIC, POOL, NEW_DELETE
+};
+
+/* all but the first of the wof rows use WOF_FLAG_SMALL_OBJECTS, which suits
+ * hash-map nodes */
+static const char *names[] = {
+    "wof::pool_resource",
+    "  +small",
+    "  +small release-only",
+    "wof::allocator<T>",
+    "monotonic_buffer",
+    "unsync_pool",
+    "new_delete",
+};
+
+static double
+run(enum kind k, unsigned long packets, unsigned long *check)
+{
+    wof::pool_resource                       wof_mr(k == WOF
+            ? 0u : (unsigned int)WOF_FLAG_SMALL_OBJECTS);
+    std::pmr::monotonic_buffer_resource      mono;
+    std::pmr::unsynchronized_pool_resource   pool;
+    std::chrono::steady_clock::time_point    start, end;
+    unsigned long                            p;
+
+    wof_mr.set_release_only(k == WOF_RELEASE_ONLY);
+    rng_state = 1;
+    *check = 0;
+
+    start = std::chrono::steady_clock::now();
+
+    for (p = 0; p < packets; p++) {
+        switch (k) {
+            case WOF:
+            case WOF_SMALL:
+            case WOF_RELEASE_ONLY:
+                *check += packet(&wof_mr);
+                wof_mr.release();
+                break;
+            case WOF_ALLOCATOR:
+                {
+                    wof::free_all_guard guard(wof_mr.pool());
+                    *check += packet_alloc(wof_mr.pool());
+                }
+                break;
+            case MONOTONIC:
+                *check += packet(&mono);
+                mono.release();
+                break;
+            case POOL:
+                *check += packet(&pool);
+                break;
+            case NEW_DELETE:
+                *check += packet(std::pmr::new_delete_resource());
+                break;
+        }
+    }
+
+    end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count()
+        / (double)packets;
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned long packets = 200000, check;
+    int           k;
+
+    if (argc > 1) {
+        packets = strtoul(argv[1], NULL, 10);
+    }
+
+    printf("%-24s %12s\n", "resource", "ns/packet");
+
+    for (k = WOF; k <= NEW_DELETE; k++) {
+        double ns = run((enum kind)k, packets, &check);
+        printf("%-24s %12.0f   (%lu)\n", names[k], ns, check);
+    }
+
+    return 0;
+}
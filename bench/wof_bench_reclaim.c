@@ -0,0 +1,118 @@
+/* Wheel-of-Fortune Memory Allocator - reclaimer benchmark
+ *
+ * Fills a pool's 8MB blocks, 32 of them, writing to every byte so that they
+ * are faulted in, frees everything with wof_free_all, and times the wof_gc
+ * that gives the blocks back. It does so on a pool whose blocks come straight
+ * from the OS, which unmaps them on the calling thread, and on one whose
+ * blocks come through a wof_reclaimer_t (with a high-water mark of 0), whose
+ * helper thread unmaps them instead. Reports the mean time the wof_gc took on
+ * the caller over a few rounds. Between rounds it sleeps for a moment, to let
+ * the helper finish.
+ *
+ * The reclaimer needs WOF_THREADS, and the unmapping only happens with blocks
+ * from the OS, so build with both, as `make wof_bench_reclaim` does:
+ *
+ *   cc -O2 -DWOF_THREADS -DWOF_USE_MMAP -I.. -o wof_bench_reclaim \
+ *       wof_bench_reclaim.c ../wof_allocator.c -lpthread
+ *
+ *   ./wof_bench_reclaim [rounds]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wof_allocator.h"
+
+#define BLOCKS     32
+#define CHUNK_SIZE (1024 * 1024)
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+settle(void)
+{
+    struct timespec ts;
+
+    ts.tv_sec  = 0;
+    ts.tv_nsec = 200 * 1000 * 1000;
+    nanosleep(&ts, NULL);
+}
+
+static void
+run(const char *name, wof_allocator_t *pool, const int rounds)
+{
+    wof_allocator_stats_t stats;
+    double                start, total = 0;
+    size_t                blocks = 0;
+    char                 *ptr;
+    int                   round;
+
+    for (round = 0; round < rounds; round++) {
+        /* seven of these fill an 8MB block */
+        do {
+            ptr = (char *)wof_alloc(pool, CHUNK_SIZE);
+            memset(ptr, 0x5a, CHUNK_SIZE);
+            wof_allocator_stats(pool, &stats);
+        } while (stats.blocks < BLOCKS ||
+                stats.largest_free >= CHUNK_SIZE);
+        blocks = stats.blocks;
+
+        wof_free_all(pool);
+
+        start = now_ns();
+        wof_gc(pool);
+        total += now_ns() - start;
+
+        settle();
+    }
+
+    printf("%-16s %8lu %10.2f\n", name, (unsigned long)blocks,
+            total / rounds / 1e6);
+}
+
+int
+main(int argc, char **argv)
+{
+    wof_allocator_options_t options;
+    wof_allocator_t        *pool;
+    wof_reclaimer_t        *reclaimer;
+    int                     rounds = 5;
+
+    if (argc > 1) {
+        rounds = atoi(argv[1]);
+    }
+
+    printf("%-16s %8s %10s\n", "", "blocks", "wof_gc ms");
+
+    pool = wof_allocator_new();
+    run("plain source", pool, rounds);
+    wof_allocator_destroy(pool);
+
+    reclaimer = wof_reclaimer_new(0, 0, NULL, NULL);
+    if (reclaimer == NULL) {
+        fprintf(stderr, "wof_reclaimer_new failed\n");
+        return 1;
+    }
+
+    wof_allocator_options_init(&options);
+    options.source     = &wof_reclaimer_source;
+    options.source_ctx = reclaimer;
+    pool = wof_allocator_new_ex(&options);
+    run("reclaimer", pool, rounds);
+    wof_allocator_destroy(pool);
+
+    wof_reclaimer_destroy(reclaimer);
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+/* Wheel-of-Fortune Memory Allocator - reservation benchmark
+ *
+ * Times each of the first N allocations (and the first write to each) on a
+ * fresh pool, and again after a wof_free_all and wof_gc have handed the
+ * pool's blocks back, with and without a wof_allocator_reserve of enough
+ * memory for all N up front. Without the reservation those allocations pay
+ * for mapping new blocks and for the page faults on first touch; with it they
+ * find pre-faulted blocks already waiting on the master stack. Reports the
+ * mean, 99th percentile and worst allocation, and the time the reservation
+ * itself took.
+ *
+ * Page faults only show up when blocks come straight from the OS, so build
+ * with WOF_USE_MMAP, as `make wof_bench_reserve` does:
+ *
+ *   cc -O2 -DWOF_USE_MMAP -I.. -o wof_bench_reserve \
+ *       wof_bench_reserve.c ../wof_allocator.c
+ *
+ *   ./wof_bench_reserve [allocations]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wof_allocator.h"
+
+static unsigned long rng_state;
+
+static unsigned long
+rng(void)
+{
+    rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+    return (unsigned long)(rng_state >> 33);
+}
+
+static size_t
+next_size(void)
+{
+    return 16 + rng() % 1024;
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Makes n allocations from the pool, timing each one along with its first
+ * write, and prints the summary. */
+static void
+run(const char *name, wof_allocator_t *pool, double *lat, size_t n,
+        double reserve_ns)
+{
+    double  start, total = 0;
+    size_t  i, size;
+    char   *ptr;
+
+    rng_state = 1;
+
+    for (i = 0; i < n; i++) {
+        size  = next_size();
+        start = now_ns();
+        ptr   = (char *)wof_alloc(pool, size);
+        memset(ptr, 0x5a, size);
+        lat[i] = now_ns() - start;
+        total += lat[i];
+    }
+
+    qsort(lat, n, sizeof(double), cmp_double);
+
+    printf("%-22s %10.0f %10.0f %10.0f %12.0f\n", name, total / n,
+            lat[n * 99 / 100], lat[n - 1], reserve_ns / 1000);
+}
+
+static double
+reserve(wof_allocator_t *pool, size_t bytes)
+{
+    double start = now_ns();
+
+    if (!wof_allocator_reserve(pool, bytes)) {
+        fprintf(stderr, "wof_allocator_reserve failed\n");
+        exit(1);
+    }
+
+    return now_ns() - start;
+}
+
+int
+main(int argc, char **argv)
+{
+    wof_allocator_t *pool;
+    double          *lat;
+    double           ns;
+    size_t           n = 50000, i, bytes = 0;
+    int              with;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    lat = (double *)malloc(n * sizeof(double));
+
+    /* the same sizes as run() draws, plus room for a chunk header each */
+    rng_state = 1;
+    for (i = 0; i < n; i++) {
+        bytes += next_size() + 32;
+    }
+
+    printf("%-22s %10s %10s %10s %12s\n", "", "mean ns", "p99 ns",
+            "max ns", "reserve us");
+
+    for (with = 0; with <= 1; with++) {
+        pool = wof_allocator_new();
+
+        ns = with ? reserve(pool, bytes) : 0;
+        run(with ? "fresh, reserved" : "fresh", pool, lat, n, ns);
+
+        /* give everything back, then do it again; the pinned blocks survive
+         * the gc, so the second reservation has nothing left to do */
+        wof_free_all(pool);
+        wof_gc(pool);
+        ns = with ? reserve(pool, bytes) : 0;
+        run(with ? "after gc, reserved" : "after gc", pool, lat, n, ns);
+
+        wof_allocator_destroy(pool);
+    }
+
+    free(lat);
+
+    return 0;
+}
@@ -0,0 +1,194 @@
+/* Wheel-of-Fortune Memory Allocator - ring benchmark
+ *
+ * Runs a pipeline eight packets deep: each packet allocates a couple of
+ * hundred objects of dissection-like sizes (every 100th packet ten times as
+ * many), and is retired once eight more have entered after it. The packets go
+ * through a wof_ring_t of eight generations, one packet each, and through
+ * eight separate pools taken in turn, each freed with wof_free_all when its
+ * packet retires (and optionally also collected with wof_gc). All of them
+ * use 64KB blocks from a counting source over malloc. Reports the time per
+ * packet and the most memory held from the source at once.
+ *
+ * Build with `make wof_bench_ring`, which comes down to:
+ *
+ *   cc -O2 -I.. -o wof_bench_ring wof_bench_ring.c ../wof_allocator.c
+ *
+ *   ./wof_bench_ring [packets]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wof_allocator.h"
+
+#define DEPTH      8
+#define BLOCK_SIZE (64 * 1024)
+
+static unsigned long rng_state;
+
+static unsigned long
+rng(void)
+{
+    rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+    return (unsigned long)(rng_state >> 33);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* A source over malloc that keeps track of how much it has handed out. */
+typedef struct {
+    size_t held;
+    size_t peak;
+} counting_t;
+
+static void *
+counting_get(void *ctx, const size_t size)
+{
+    counting_t *c = (counting_t *)ctx;
+
+    c->held += size;
+    if (c->held > c->peak) {
+        c->peak = c->held;
+    }
+
+    return malloc(size);
+}
+
+static void
+counting_release(void *ctx, void *block, const size_t size)
+{
+    counting_t *c = (counting_t *)ctx;
+
+    c->held -= size;
+    free(block);
+}
+
+static const wof_block_source_t counting_source = {
+    counting_get,
+    counting_release,
+    NULL,
+    NULL
+};
+
+/* Allocates one packet's worth of objects from the pool. */
+static void
+packet(wof_allocator_t *pool, const unsigned long n)
+{
+    unsigned long i, count;
+    size_t        size;
+    char         *ptr;
+
+    count = n % 100 == 99 ? 2000 : 200;
+
+    for (i = 0; i < count; i++) {
+        size = rng() % 100 < 90 ? 16 + rng() % 240 : 256 + rng() % 1792;
+        ptr  = (char *)wof_alloc(pool, size);
+        memset(ptr, 0x5a, size < 64 ? size : 64);
+    }
+}
+
+static void
+report(const char *name, const double ns, const unsigned long packets,
+        const counting_t *c)
+{
+    printf("%-24s %10.2f %10lu\n", name, ns / packets / 1000,
+            (unsigned long)(c->peak / 1024));
+}
+
+static void
+run_ring(const unsigned long packets)
+{
+    wof_allocator_options_t options;
+    wof_ring_t             *ring;
+    counting_t              c = { 0, 0 };
+    size_t                  in_flight[DEPTH];
+    unsigned long           n;
+    double                  start;
+
+    wof_allocator_options_init(&options);
+    options.block_size = BLOCK_SIZE;
+    options.source     = &counting_source;
+    options.source_ctx = &c;
+
+    ring = wof_ring_new(DEPTH, 1, &options);
+
+    rng_state = 1;
+    start = now_ns();
+    for (n = 0; n < packets; n++) {
+        if (n >= DEPTH) {
+            wof_ring_retire(ring, in_flight[n % DEPTH]);
+        }
+        in_flight[n % DEPTH] = wof_ring_begin(ring);
+        packet(wof_ring_pool(ring, in_flight[n % DEPTH]), n);
+    }
+    report("wof_ring", now_ns() - start, packets, &c);
+
+    wof_ring_destroy(ring);
+}
+
+static void
+run_pools(const unsigned long packets, const int gc)
+{
+    wof_allocator_options_t options;
+    wof_allocator_t        *pools[DEPTH];
+    counting_t              c = { 0, 0 };
+    unsigned long           n;
+    double                  start;
+    int                     i;
+
+    wof_allocator_options_init(&options);
+    options.block_size = BLOCK_SIZE;
+    options.source     = &counting_source;
+    options.source_ctx = &c;
+
+    for (i = 0; i < DEPTH; i++) {
+        pools[i] = wof_allocator_new_ex(&options);
+    }
+
+    rng_state = 1;
+    start = now_ns();
+    for (n = 0; n < packets; n++) {
+        if (n >= DEPTH) {
+            wof_free_all(pools[n % DEPTH]);
+            if (gc) {
+                wof_gc(pools[n % DEPTH]);
+            }
+        }
+        packet(pools[n % DEPTH], n);
+    }
+    report(gc ? "pools, free_all + gc" : "pools, free_all",
+            now_ns() - start, packets, &c);
+
+    for (i = 0; i < DEPTH; i++) {
+        wof_allocator_destroy(pools[i]);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned long packets = 100000;
+
+    if (argc > 1) {
+        packets = strtoul(argv[1], NULL, 10);
+    }
+
+    printf("%-24s %10s %10s\n", "", "us/packet", "peak KB");
+
+    run_ring(packets);
+    run_pools(packets, 0);
+    run_pools(packets, 1);
+
+    return 0;
+}
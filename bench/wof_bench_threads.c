@@ -0,0 +1,166 @@
+/* Wheel-of-Fortune Memory Allocator - thread scaling benchmark
+ *
+ * Each thread owns one pool. In every round, each thread allocates a batch of
+ * variable-sized buffers, then frees three quarters of its own buffers and a
+ * quarter of its neighbour's, so that a steady fraction of all frees cross
+ * threads. The same workload is run against malloc/free for reference.
+ *
+ * The allocator must be built with WOF_THREADS, as `make wof_bench_threads`
+ * does, e.g.:
+ *
+ *   cc -O2 -DWOF_THREADS -I.. -o wof_bench_threads \
+ *       wof_bench_threads.c ../wof_allocator.c -lpthread
+ *
+ *   ./wof_bench_threads [max_threads] [rounds] [batch]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "wof_allocator.h"
+
+#ifndef WOF_THREADS
+#error "wof_bench_threads needs the allocator to be built with WOF_THREADS"
+#endif
+
+typedef struct {
+    int               id;
+    int               nthreads;
+    int               use_wof;
+    wof_allocator_t  *pool;
+    void            **slots;
+} worker_t;
+
+static int               rounds = 200;
+static int               batch  = 4096;
+static worker_t         *workers;
+static pthread_barrier_t barrier;
+
+static void *
+bench_alloc(worker_t *w, size_t size)
+{
+    return w->use_wof ? wof_alloc(w->pool, size) : malloc(size);
+}
+
+static void
+bench_free(worker_t *w, void *ptr)
+{
+    if (w->use_wof) {
+        wof_free(w->pool, ptr);
+    }
+    else {
+        free(ptr);
+    }
+}
+
+static void *
+worker_main(void *arg)
+{
+    worker_t     *w = (worker_t *)arg;
+    worker_t     *neighbour;
+    unsigned int  seed;
+    int           r, i;
+
+    seed = 12345u + (unsigned int)w->id;
+    neighbour = &workers[(w->id + 1) % w->nthreads];
+
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < batch; i++) {
+            seed = seed * 1103515245u + 12345u;
+            w->slots[i] = bench_alloc(w, 16 + (seed >> 16) % 496);
+        }
+
+        pthread_barrier_wait(&barrier);
+
+        for (i = 0; i < batch; i++) {
+            if (i % 4 == 0) {
+                /* every fourth buffer is freed by the thread to our left */
+                bench_free(w, neighbour->slots[i]);
+            }
+            else {
+                bench_free(w, w->slots[i]);
+            }
+        }
+
+        pthread_barrier_wait(&barrier);
+    }
+
+    return NULL;
+}
+
+static double
+run(int nthreads, int use_wof)
+{
+    pthread_t       *threads;
+    struct timespec  start, end;
+    int              t;
+
+    threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    workers = (worker_t *)malloc(nthreads * sizeof(worker_t));
+    pthread_barrier_init(&barrier, NULL, nthreads);
+
+    for (t = 0; t < nthreads; t++) {
+        workers[t].id       = t;
+        workers[t].nthreads = nthreads;
+        workers[t].use_wof  = use_wof;
+        workers[t].pool     = use_wof ? wof_allocator_new() : NULL;
+        workers[t].slots    = (void **)malloc(batch * sizeof(void *));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (t = 0; t < nthreads; t++) {
+        pthread_create(&threads[t], NULL, worker_main, &workers[t]);
+    }
+    for (t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (t = 0; t < nthreads; t++) {
+        if (use_wof) {
+            wof_allocator_destroy(workers[t].pool);
+        }
+        free(workers[t].slots);
+    }
+
+    pthread_barrier_destroy(&barrier);
+    free(workers);
+    free(threads);
+
+    /* millions of operations (one alloc plus one free each) per second */
+    return (2.0 * nthreads * rounds * batch) /
+        ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+        * 1e3;
+}
+
+int
+main(int argc, char **argv)
+{
+    int    max_threads, n;
+    double wof, sys, wof_base = 0;
+
+    max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    rounds      = argc > 2 ? atoi(argv[2]) : rounds;
+    batch       = argc > 3 ? atoi(argv[3]) : batch;
+
+    printf("%8s %14s %14s %10s\n", "threads", "wof Mops/s", "malloc Mops/s",
+            "wof scale");
+
+    for (n = 1; n <= max_threads; n *= 2) {
+        wof = run(n, 1);
+        sys = run(n, 0);
+        if (n == 1) {
+            wof_base = wof;
+        }
+        printf("%8d %14.1f %14.1f %9.2fx\n", n, wof, sys, wof / wof_base);
+        if (n < max_threads && n * 2 > max_threads) {
+            n = max_threads / 2;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,395 @@
+/* Wheel-of-Fortune Memory Allocator - marks self-check
+ *
+ * Runs a long random sequence of operations against a pool while keeping a
+ * model of what should be live in it: allocations of every kind (ordinary,
+ * aligned, nofree and jumbo, the last well past the pool's block size),
+ * frees, reallocs, nested marks, releases to any active mark, wof_gc and
+ * wof_free_all. Every allocation is filled with a pattern of its own, and the
+ * patterns of everything the model holds are checked after every release,
+ * every wof_free_all and every so often in between, so an object that a
+ * release or a free_all damaged, or that was handed out twice, shows up as a
+ * mismatch. An object moved by a realloc after a mark belongs to that mark,
+ * and goes with it. After each release and wof_free_all it also checks that
+ * the pool holds no more jumbo blocks than the model has objects big enough
+ * to need one, so that jumbo blocks taken after a mark go with it too.
+ *
+ * It does so for a plain pool and for pools with the small-object layer and
+ * with the free-chunk index. It prints the first mismatch and exits with 1,
+ * or prints a line per pool and exits with 0. `make check` builds and runs
+ * it; `make wof_check_marks` only builds it, which comes down to:
+ *
+ *   cc -O2 -I.. -o wof_check_marks wof_check_marks.c ../wof_allocator.c
+ *
+ *   ./wof_check_marks [operations] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wof_allocator.h"
+
+#define BLOCK_SIZE (256 * 1024)
+#define MAX_OBJS   4096
+#define MAX_MARKS  8
+
+#define KIND_PLAIN   0
+#define KIND_ALIGNED 1
+#define KIND_NOFREE  2
+
+typedef struct {
+    unsigned char *ptr;
+    size_t         size;
+    unsigned char  seed;
+    int            kind;
+    /* whether it may be in a jumbo block of its own */
+    int            big;
+    /* how many marks were active when it was allocated, or moved */
+    int            depth;
+} obj_t;
+
+static obj_t         objs[MAX_OBJS];
+static int           n_objs;
+static wof_mark_t   *marks[MAX_MARKS];
+static int           n_marks;
+static unsigned long rng_state;
+static unsigned long op;
+
+/* what a run got up to, for the report */
+static unsigned long releases;
+static unsigned long jumbos_in_marks;
+static int           max_depth;
+
+static unsigned long
+rng(void)
+{
+    rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+    return (unsigned long)(rng_state >> 33);
+}
+
+static void
+fail(const char *pool, const char *what)
+{
+    fprintf(stderr, "%s: %s at operation %lu\n", pool, what, op);
+    exit(1);
+}
+
+static void
+fill(obj_t *obj, const size_t from)
+{
+    size_t i;
+
+    for (i = from; i < obj->size; i++) {
+        obj->ptr[i] = (unsigned char)(obj->seed + i * 7);
+    }
+}
+
+/* Checks the first `size` bytes of an object against its pattern. */
+static void
+check(const char *pool, const obj_t *obj, const size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        if (obj->ptr[i] != (unsigned char)(obj->seed + i * 7)) {
+            fprintf(stderr, "%s: object %p (%lu bytes) damaged at byte %lu\n",
+                    pool, (void *)obj->ptr, (unsigned long)obj->size,
+                    (unsigned long)i);
+            fail(pool, "pattern mismatch");
+        }
+    }
+}
+
+static void
+check_all(const char *pool)
+{
+    int k;
+
+    for (k = 0; k < n_objs; k++) {
+        check(pool, &objs[k], objs[k].size);
+    }
+}
+
+static void
+check_jumbo(const char *pool, const wof_allocator_t *allocator)
+{
+    wof_allocator_stats_t stats;
+    size_t                big = 0;
+    int                   k;
+
+    for (k = 0; k < n_objs; k++) {
+        big += objs[k].big;
+    }
+
+    wof_allocator_stats(allocator, &stats);
+    if (stats.jumbo_blocks > big) {
+        fprintf(stderr, "%s: %lu jumbo blocks for %lu big objects\n", pool,
+                (unsigned long)stats.jumbo_blocks, (unsigned long)big);
+        fail(pool, "jumbo block leaked");
+    }
+}
+
+/* Takes the object at k out of the model, by moving the last one there. */
+static void
+forget(const int k)
+{
+    objs[k] = objs[--n_objs];
+}
+
+static size_t
+random_size(void)
+{
+    unsigned long r = rng() % 1000;
+
+    if (r < 700) {
+        return 1 + rng() % 256;
+    }
+    else if (r < 950) {
+        return 256 + rng() % 4096;
+    }
+    else if (r < 990) {
+        return 4096 + rng() % (BLOCK_SIZE / 4);
+    }
+    /* jumbo */
+    return BLOCK_SIZE + rng() % (4 * BLOCK_SIZE);
+}
+
+static void
+do_alloc(const char *pool, wof_allocator_t *allocator)
+{
+    obj_t        *obj;
+    unsigned long r;
+
+    if (n_objs == MAX_OBJS) {
+        return;
+    }
+
+    obj = &objs[n_objs];
+    obj->size  = random_size();
+    obj->seed  = (unsigned char)rng();
+    obj->depth = n_marks;
+    obj->big   = obj->size > BLOCK_SIZE / 2;
+
+    r = rng() % 10;
+    if (r < 7) {
+        obj->kind = KIND_PLAIN;
+        obj->ptr  = (unsigned char *)wof_alloc(allocator, obj->size);
+    }
+    else if (r < 9) {
+        obj->kind = KIND_ALIGNED;
+        obj->ptr  = (unsigned char *)wof_alloc_aligned(allocator, obj->size,
+                (size_t)16 << (rng() % 9));
+    }
+    else {
+        obj->kind = KIND_NOFREE;
+        obj->ptr  = (unsigned char *)wof_alloc_nofree(allocator, obj->size);
+    }
+
+    if (obj->ptr == NULL) {
+        fail(pool, "allocation failed");
+    }
+    if (obj->size > BLOCK_SIZE && n_marks) {
+        jumbos_in_marks++;
+    }
+
+    fill(obj, 0);
+    n_objs++;
+}
+
+static void
+do_free(wof_allocator_t *allocator)
+{
+    int k;
+
+    if (n_objs == 0) {
+        return;
+    }
+
+    k = (int)(rng() % n_objs);
+    if (objs[k].kind == KIND_NOFREE) {
+        return;
+    }
+
+    wof_free(allocator, objs[k].ptr);
+    forget(k);
+}
+
+static void
+do_realloc(const char *pool, wof_allocator_t *allocator)
+{
+    unsigned char *ptr;
+    obj_t         *obj;
+    size_t         size, kept;
+    int            k;
+
+    if (n_objs == 0) {
+        return;
+    }
+
+    k   = (int)(rng() % n_objs);
+    obj = &objs[k];
+    if (obj->kind == KIND_NOFREE) {
+        return;
+    }
+
+    size = rng() % 2 ? obj->size + 1 + rng() % 512 : random_size();
+    ptr  = (unsigned char *)wof_realloc(allocator, obj->ptr, size);
+    if (ptr == NULL) {
+        fail(pool, "realloc failed");
+    }
+
+    kept = size < obj->size ? size : obj->size;
+    if (ptr != obj->ptr) {
+        obj->depth = n_marks;
+        obj->kind  = KIND_PLAIN;
+    }
+    /* a jumbo block may be shrunk (and even moved) by the source, rather
+     * than the object moved out of it */
+    if (size > BLOCK_SIZE / 2) {
+        obj->big = 1;
+    }
+    obj->ptr  = ptr;
+    obj->size = size;
+
+    /* what was kept must have come along unchanged */
+    check(pool, obj, kept);
+    fill(obj, kept);
+}
+
+static void
+do_mark(const char *pool, wof_allocator_t *allocator)
+{
+    if (n_marks == MAX_MARKS) {
+        return;
+    }
+
+    marks[n_marks] = wof_mark(allocator);
+    if (marks[n_marks] == NULL) {
+        fail(pool, "wof_mark failed");
+    }
+    n_marks++;
+    if (n_marks > max_depth) {
+        max_depth = n_marks;
+    }
+}
+
+static void
+do_release(const char *pool, wof_allocator_t *allocator)
+{
+    int m, k;
+
+    if (n_marks == 0) {
+        return;
+    }
+
+    /* mostly the innermost mark, but sometimes one further out */
+    m = rng() % 4 ? n_marks - 1 : (int)(rng() % n_marks);
+    wof_release_to_mark(allocator, marks[m]);
+    n_marks = m;
+    releases++;
+
+    for (k = 0; k < n_objs; ) {
+        if (objs[k].depth > m) {
+            forget(k);
+        }
+        else {
+            k++;
+        }
+    }
+
+    check_all(pool);
+    check_jumbo(pool, allocator);
+}
+
+static void
+do_free_all(const char *pool, wof_allocator_t *allocator)
+{
+    wof_free_all(allocator);
+    n_objs  = 0;
+    n_marks = 0;
+    check_jumbo(pool, allocator);
+
+    /* the pool must still hand out memory that holds its patterns */
+    do_alloc(pool, allocator);
+    do_alloc(pool, allocator);
+    check_all(pool);
+}
+
+static void
+run(const char *pool, const unsigned int flags, const unsigned long ops,
+        const unsigned long seed)
+{
+    wof_allocator_options_t options;
+    wof_allocator_t        *allocator;
+    unsigned long           r;
+
+    wof_allocator_options_init(&options);
+    options.block_size = BLOCK_SIZE;
+    options.flags      = flags;
+    allocator = wof_allocator_new_ex(&options);
+    if (allocator == NULL) {
+        fail(pool, "wof_allocator_new_ex failed");
+    }
+
+    n_objs          = 0;
+    n_marks         = 0;
+    releases        = 0;
+    jumbos_in_marks = 0;
+    max_depth       = 0;
+    rng_state       = seed;
+
+    for (op = 0; op < ops; op++) {
+        r = rng() % 1000;
+        if (r < 500) {
+            do_alloc(pool, allocator);
+        }
+        else if (r < 700) {
+            do_free(allocator);
+        }
+        else if (r < 850) {
+            do_realloc(pool, allocator);
+        }
+        else if (r < 920) {
+            do_mark(pool, allocator);
+        }
+        else if (r < 985) {
+            do_release(pool, allocator);
+        }
+        else if (r < 995) {
+            wof_gc(allocator);
+        }
+        else {
+            do_free_all(pool, allocator);
+        }
+
+        if (op % 256 == 0) {
+            check_all(pool);
+        }
+    }
+
+    check_all(pool);
+    wof_allocator_destroy(allocator);
+
+    printf("%-6s ok: %lu operations, %lu releases, marks up to %d deep, "
+            "%lu jumbo allocations under a mark\n", pool, ops, releases,
+            max_depth, jumbos_in_marks);
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned long ops = 200000, seed = 1;
+
+    if (argc > 1) {
+        ops = strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        seed = strtoul(argv[2], NULL, 10);
+    }
+
+    run("plain", 0, ops, seed);
+    run("small", WOF_FLAG_SMALL_OBJECTS, ops, seed);
+    run("tlsf", WOF_FLAG_TLSF_INDEX, ops, seed);
+
+    return 0;
+}
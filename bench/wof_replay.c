@@ -0,0 +1,536 @@
+/* Wheel-of-Fortune Memory Allocator - trace replay
+ *
+ * Replays a trace recorded with wof_trace_start (see wof_allocator.h for the
+ * format) against a pool configured from the command line, and reports:
+ *  - throughput, in calls per second and ns per call
+ *  - peak footprint: the most memory the pool held from its block source at
+ *    any one time, next to the most bytes that were live at any one time
+ *  - fragmentation, sampled just before each wof_free_all and at the end
+ *  - how ordinary allocations were served: recycler vs master vs new block
+ *
+ * The allocator does not need to be built with WOF_TRACE to replay, so build
+ * it with whatever options are to be tested. `make wof_replay` uses
+ * WOF_USE_MMAP, plus anything in WOF_FLAGS; by hand that is something like:
+ *
+ *   cc -O2 -I.. -DWOF_USE_MMAP -o wof_replay wof_replay.c ../wof_allocator.c
+ *   ./wof_replay [-b block_size] [-s] [-t | -c] trace
+ *
+ * -b sets the block size in bytes, -s enables the small-object layer and -t
+ * the free-chunk index. -c replays the trace twice, once against the wheel
+ * recycler and once against the free-chunk index, and compares the two.
+ *
+ * The trace is decoded up front so that only the allocator is timed. Every
+ * allocation has its first few bytes written, as a real program would.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wof_allocator.h"
+
+/* For RELEASE, size is the number of marks popped, and for RESERVE the number
+ * of bytes. */
+typedef struct {
+    int           op;
+    unsigned long id;
+    size_t        size;
+    size_t        alignment;
+} replay_op_t;
+
+/* A block source that keeps track of how much it has handed out. */
+
+typedef struct {
+    size_t current;
+    size_t peak;
+} counting_source_t;
+
+static void *
+counting_get_block(void *ctx, const size_t size)
+{
+    counting_source_t *counter = (counting_source_t *)ctx;
+    void              *block;
+
+    block = malloc(size);
+    if (block) {
+        counter->current += size;
+        if (counter->current > counter->peak) {
+            counter->peak = counter->current;
+        }
+    }
+    return block;
+}
+
+static void
+counting_release_block(void *ctx, void *block, const size_t size)
+{
+    counting_source_t *counter = (counting_source_t *)ctx;
+
+    counter->current -= size;
+    free(block);
+}
+
+static void *
+counting_resize_block(void *ctx, void *block,
+                      const size_t old_size, const size_t new_size)
+{
+    counting_source_t *counter = (counting_source_t *)ctx;
+    void              *new_block;
+
+    new_block = realloc(block, new_size);
+    if (new_block) {
+        counter->current += new_size - old_size;
+        if (counter->current > counter->peak) {
+            counter->peak = counter->current;
+        }
+    }
+    return new_block;
+}
+
+static const wof_block_source_t counting_source = {
+    counting_get_block,
+    counting_release_block,
+    counting_resize_block,
+    NULL
+};
+
+/* DECODING */
+
+static int
+read_varint(const unsigned char **pos, const unsigned char *end,
+            size_t *value)
+{
+    unsigned int shift = 0;
+
+    *value = 0;
+    while (*pos < end) {
+        *value |= (size_t)(**pos & 0x7F) << shift;
+        if ((*(*pos)++ & 0x80) == 0) {
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+/* Decodes a whole trace, turning object deltas back into absolute IDs.
+ * Returns the number of ops, or -1 if the trace is malformed. */
+static long
+decode_trace(const unsigned char *data, size_t len,
+             replay_op_t **ops_out, unsigned long *n_ids)
+{
+    const unsigned char *pos, *end;
+    replay_op_t         *ops;
+    unsigned long        next_id = 1;
+    size_t               n = 0, capacity = 1024, delta;
+
+    pos = data + 5;
+    end = data + len;
+
+    if (len < 5 || memcmp(data, WOF_TRACE_MAGIC, 4) != 0 ||
+            data[4] != WOF_TRACE_VERSION) {
+        return -1;
+    }
+
+    ops = (replay_op_t *)malloc(capacity * sizeof(replay_op_t));
+
+    while (pos < end) {
+        if (n == capacity) {
+            capacity *= 2;
+            ops = (replay_op_t *)realloc(ops, capacity * sizeof(replay_op_t));
+        }
+
+        ops[n].op   = *pos++;
+        ops[n].id   = 0;
+        ops[n].size = 0;
+        ops[n].alignment = 0;
+
+        switch (ops[n].op) {
+            case WOF_TRACE_ALLOC:
+            case WOF_TRACE_ALLOC_NOFREE:
+                if (!read_varint(&pos, end, &ops[n].size)) {
+                    goto malformed;
+                }
+                next_id++;
+                break;
+            case WOF_TRACE_ALLOC_ALIGNED:
+                if (!read_varint(&pos, end, &ops[n].size) ||
+                        !read_varint(&pos, end, &ops[n].alignment)) {
+                    goto malformed;
+                }
+                next_id++;
+                break;
+            case WOF_TRACE_FREE:
+            case WOF_TRACE_REALLOC:
+                if (!read_varint(&pos, end, &delta) || delta >= next_id) {
+                    goto malformed;
+                }
+                ops[n].id = delta ? next_id - delta : 0;
+                if (ops[n].op == WOF_TRACE_REALLOC) {
+                    if (!read_varint(&pos, end, &ops[n].size)) {
+                        goto malformed;
+                    }
+                    next_id++;
+                }
+                break;
+            case WOF_TRACE_RELEASE:
+            case WOF_TRACE_RESERVE:
+                if (!read_varint(&pos, end, &ops[n].size)) {
+                    goto malformed;
+                }
+                break;
+            case WOF_TRACE_FREE_ALL:
+            case WOF_TRACE_GC:
+            case WOF_TRACE_GC_TRIM:
+            case WOF_TRACE_GC_POLICY:
+            case WOF_TRACE_MARK:
+                break;
+            default:
+                goto malformed;
+        }
+        n++;
+    }
+
+    *ops_out = ops;
+    *n_ids   = next_id;
+    return (long)n;
+
+malformed:
+    free(ops);
+    return -1;
+}
+
+/* REPLAY */
+
+typedef struct {
+    double        ns;
+    size_t        peak_footprint;
+    size_t        peak_live;
+    double        frag_sum;
+    double        frag_max;
+    unsigned long frag_samples;
+    wof_allocator_stats_t stats;
+} replay_result_t;
+
+/* Samples the pool's fragmentation. This walks the free chunks, so it is
+ * kept out of the timed region. */
+static void
+sample_fragmentation(wof_allocator_t *allocator, replay_result_t *result)
+{
+    wof_allocator_stats_t stats;
+
+    wof_allocator_stats(allocator, &stats);
+    if (stats.bytes_free == 0) {
+        return;
+    }
+
+    result->frag_sum += stats.fragmentation;
+    if (stats.fragmentation > result->frag_max) {
+        result->frag_max = stats.fragmentation;
+    }
+    result->frag_samples++;
+}
+
+/* Replays the decoded trace against a new pool built from options. The pool
+ * is sampled for fragmentation just before every FREE_ALL and at the end,
+ * when as much as possible is live. Returns 0 if the pool can't be built. */
+static int
+replay(const replay_op_t *ops, long n, unsigned long n_ids,
+       wof_allocator_options_t options, replay_result_t *result)
+{
+    wof_allocator_t   *allocator;
+    counting_source_t  counter = { 0, 0 };
+    struct timespec    start, end;
+    void             **objs;
+    size_t            *sizes;
+    unsigned long     *born;
+    size_t             live = 0;
+    wof_mark_t       **marks;
+    unsigned long     *mark_ids;
+    unsigned long      next_id = 1, id;
+    long               i, depth = 0;
+
+    memset(result, 0, sizeof(*result));
+
+    options.source     = &counting_source;
+    options.source_ctx = &counter;
+    allocator = wof_allocator_new_ex(&options);
+    if (allocator == NULL) {
+        return 0;
+    }
+
+    objs  = (void **)calloc(n_ids, sizeof(void *));
+    sizes = (size_t *)calloc(n_ids, sizeof(size_t));
+    born  = (unsigned long *)calloc(n_ids, sizeof(unsigned long));
+
+    /* the stack of active marks, with the first ID allocated under each */
+    marks    = (wof_mark_t **)malloc((n + 1) * sizeof(wof_mark_t *));
+    mark_ids = (unsigned long *)malloc((n + 1) * sizeof(unsigned long));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < n; i++) {
+        const replay_op_t *op = &ops[i];
+
+        switch (op->op) {
+            case WOF_TRACE_ALLOC:
+                objs[next_id] = wof_alloc(allocator, op->size);
+                if (objs[next_id]) {
+                    memset(objs[next_id], 0, op->size < 16 ? op->size : 16);
+                    sizes[next_id] = op->size;
+                    born[next_id]  = next_id;
+                    live += op->size;
+                }
+                next_id++;
+                break;
+            case WOF_TRACE_ALLOC_NOFREE:
+                objs[next_id] = wof_alloc_nofree(allocator, op->size);
+                if (objs[next_id]) {
+                    memset(objs[next_id], 0, op->size < 16 ? op->size : 16);
+                    sizes[next_id] = op->size;
+                    born[next_id]  = next_id;
+                    live += op->size;
+                }
+                next_id++;
+                break;
+            case WOF_TRACE_ALLOC_ALIGNED:
+                objs[next_id] = wof_alloc_aligned(allocator, op->size,
+                        op->alignment);
+                if (objs[next_id]) {
+                    memset(objs[next_id], 0, op->size < 16 ? op->size : 16);
+                    sizes[next_id] = op->size;
+                    born[next_id]  = next_id;
+                    live += op->size;
+                }
+                next_id++;
+                break;
+            case WOF_TRACE_FREE:
+                wof_free(allocator, objs[op->id]);
+                live -= sizes[op->id];
+                objs[op->id]  = NULL;
+                sizes[op->id] = 0;
+                break;
+            case WOF_TRACE_REALLOC:
+                objs[next_id] = wof_realloc(allocator, objs[op->id], op->size);
+                if (objs[next_id]) {
+                    memset(objs[next_id], 0, op->size < 16 ? op->size : 16);
+                }
+                if (objs[next_id] || op->size == 0) {
+                    /* the old object is gone (unless the realloc failed) */
+                    live += op->size - sizes[op->id];
+                    sizes[next_id] = op->size;
+                    born[next_id]  = objs[next_id] == objs[op->id] && op->id
+                        ? born[op->id] : next_id;
+                    objs[op->id]  = NULL;
+                    sizes[op->id] = 0;
+                }
+                next_id++;
+                break;
+            case WOF_TRACE_FREE_ALL:
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                result->ns += (end.tv_sec - start.tv_sec) * 1e9 +
+                              (end.tv_nsec - start.tv_nsec);
+                sample_fragmentation(allocator, result);
+                clock_gettime(CLOCK_MONOTONIC, &start);
+
+                wof_free_all(allocator);
+                live  = 0;
+                depth = 0;
+                break;
+            case WOF_TRACE_MARK:
+                marks[depth]    = wof_mark(allocator);
+                mark_ids[depth] = next_id;
+                depth++;
+                break;
+            case WOF_TRACE_RELEASE:
+                if (op->size == 0 || (long)op->size > depth) {
+                    /* a mark taken before the trace started */
+                    break;
+                }
+                depth -= (long)op->size;
+                wof_release_to_mark(allocator, marks[depth]);
+                for (id = mark_ids[depth]; id < next_id; id++) {
+                    if (born[id] >= mark_ids[depth]) {
+                        live -= sizes[id];
+                        objs[id]  = NULL;
+                        sizes[id] = 0;
+                    }
+                }
+                break;
+            case WOF_TRACE_GC:
+                wof_gc(allocator);
+                break;
+            case WOF_TRACE_GC_TRIM:
+                wof_gc_trim(allocator);
+                break;
+            case WOF_TRACE_GC_POLICY:
+                wof_gc_policy(allocator);
+                break;
+            case WOF_TRACE_RESERVE:
+                wof_allocator_reserve(allocator, op->size);
+                break;
+        }
+
+        if (live > result->peak_live) {
+            result->peak_live = live;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->ns += (end.tv_sec - start.tv_sec) * 1e9 +
+                  (end.tv_nsec - start.tv_nsec);
+
+    sample_fragmentation(allocator, result);
+    wof_allocator_stats(allocator, &result->stats);
+    result->peak_footprint = counter.peak;
+
+    wof_allocator_destroy(allocator);
+    free(objs);
+    free(sizes);
+    free(born);
+    free(marks);
+    free(mark_ids);
+
+    return 1;
+}
+
+static void
+print_result(long n, const replay_result_t *result)
+{
+    const wof_allocator_stats_t *stats = &result->stats;
+    unsigned long served;
+
+    served = stats->recycler_hits + stats->master_hits +
+             stats->new_block_hits;
+
+    printf("calls:          %ld\n", n);
+    printf("throughput:     %.0f calls/s (%.1f ns/call)\n",
+            n ? n * 1e9 / result->ns : 0.0, n ? result->ns / n : 0.0);
+    printf("peak footprint: %lu KB (peak live %lu KB)\n",
+            (unsigned long)(result->peak_footprint / 1024),
+            (unsigned long)(result->peak_live / 1024));
+    printf("fragmentation:  mean %.3f, worst %.3f (%lu samples)\n",
+            result->frag_samples ?
+                result->frag_sum / result->frag_samples : 0.0,
+            result->frag_max, result->frag_samples);
+    printf("served by:      recycler %lu (%.1f%%), master %lu (%.1f%%), "
+            "new block %lu (%.1f%%)\n",
+            stats->recycler_hits,
+            served ? 100.0 * stats->recycler_hits / served : 0.0,
+            stats->master_hits,
+            served ? 100.0 * stats->master_hits / served : 0.0,
+            stats->new_block_hits,
+            served ? 100.0 * stats->new_block_hits / served : 0.0);
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-b block_size] [-s] [-t | -c] trace\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    wof_allocator_options_t options;
+    replay_result_t         wheel, tlsf;
+    replay_op_t            *ops;
+    struct stat             st;
+    const unsigned char    *data;
+    unsigned long           n_ids;
+    long                    n;
+    int                     opt, fd, compare = 0;
+
+    wof_allocator_options_init(&options);
+
+    while ((opt = getopt(argc, argv, "b:stc")) != -1) {
+        switch (opt) {
+            case 'b':
+                options.block_size = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                options.flags |= WOF_FLAG_SMALL_OBJECTS;
+                break;
+            case 't':
+                options.flags |= WOF_FLAG_TLSF_INDEX;
+                break;
+            case 'c':
+                compare = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    data = (const unsigned char *)mmap(NULL, st.st_size, PROT_READ,
+            MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    n = decode_trace(data, st.st_size, &ops, &n_ids);
+    munmap((void *)data, st.st_size);
+    close(fd);
+
+    if (n < 0) {
+        fprintf(stderr, "%s: not a valid trace\n", argv[optind]);
+        return 1;
+    }
+
+    if (!compare) {
+        if (!replay(ops, n, n_ids, options, &wheel)) {
+            fprintf(stderr, "invalid allocator configuration\n");
+            return 1;
+        }
+        print_result(n, &wheel);
+        free(ops);
+        return 0;
+    }
+
+    /* the same trace against the wheel and then against the index */
+    options.flags &= ~WOF_FLAG_TLSF_INDEX;
+    if (!replay(ops, n, n_ids, options, &wheel)) {
+        fprintf(stderr, "invalid allocator configuration\n");
+        return 1;
+    }
+    options.flags |= WOF_FLAG_TLSF_INDEX;
+    replay(ops, n, n_ids, options, &tlsf);
+
+    printf("== wheel recycler ==\n");
+    print_result(n, &wheel);
+    printf("\n== free-chunk index ==\n");
+    print_result(n, &tlsf);
+    printf("\nindex vs wheel: %+.1f%% ns/call, %+.1f%% peak footprint, "
+            "mean fragmentation %.3f -> %.3f\n",
+            wheel.ns ? 100.0 * (tlsf.ns - wheel.ns) / wheel.ns : 0.0,
+            wheel.peak_footprint ?
+                100.0 * ((double)tlsf.peak_footprint - wheel.peak_footprint)
+                / wheel.peak_footprint : 0.0,
+            wheel.frag_samples ? wheel.frag_sum / wheel.frag_samples : 0.0,
+            tlsf.frag_samples ? tlsf.frag_sum / tlsf.frag_samples : 0.0);
+
+    free(ops);
+
+    return 0;
+}
@@ -2,889 +2,4335 @@
  * Copyright 2013, Evan Huus <eapache@gmail.com>
  */
 
+/* When built with WOF_USE_MMAP, blocks are mapped directly from the OS rather
+ * than coming from malloc, so that we control when their pages are returned. */
+#ifdef WOF_USE_MMAP
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for mremap, where there is one */
+#endif
+#include <sys/mman.h>
+#include <unistd.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif /* WOF_USE_MMAP */
+
+/* vsnprintf, for wof_strbuf_append_printf, is C99, but is everywhere */
+#ifndef _ISOC99_SOURCE
+#define _ISOC99_SOURCE
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef WOF_THREADS
+#include <pthread.h>
+#endif /* WOF_THREADS */
 
 #include "wof_allocator.h"
+#include "wof_allocator_inline.h"
 
 #define BOOL int
 #define TRUE 1
 #define FALSE 0
 
-/* https://mail.gnome.org/archives/gtk-devel-list/2004-December/msg00091.html
- * The 2*sizeof(size_t) alignment here is borrowed from GNU libc, so it should
- * be good most everywhere. It is more conservative than is needed on some
- * 64-bit platforms, but ia64 does require a 16-byte alignment. The SIMD
- * extensions for x86 and ppc32 would want a larger alignment than this, but
- * we don't need to do better than malloc.
- */
-#define WOF_ALIGN_AMOUNT (2 * sizeof (size_t))
-#define WOF_ALIGN_SIZE(SIZE) ((~(WOF_ALIGN_AMOUNT-1)) & \
-        ((SIZE) + (WOF_ALIGN_AMOUNT-1)))
-
-/* When required, allocate more memory from the OS in chunks of this size.
+/* When built with WOF_THREADS, chunks may be freed by a thread other than the
+ * one that owns their pool. Those frees are handed back to the owner through
+ * lock-free lists, which need a few atomic operations. */
+#ifdef WOF_THREADS
+#define WOF_ATOMIC_LOAD(PTR) __atomic_load_n((PTR), __ATOMIC_ACQUIRE)
+#define WOF_ATOMIC_EXCHANGE(PTR, VAL) \
+        __atomic_exchange_n((PTR), (VAL), __ATOMIC_ACQ_REL)
+#define WOF_ATOMIC_CAS(PTR, EXPECTED, VAL) \
+        __atomic_compare_exchange_n((PTR), (EXPECTED), (VAL), TRUE, \
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#define WOF_ATOMIC_ADD(PTR, VAL) \
+        __atomic_add_fetch((PTR), (VAL), __ATOMIC_ACQ_REL)
+#endif /* WOF_THREADS */
+
+/* When required, allocate more memory from the OS in chunks of this size
+ * (unless the pool was created with some other block size).
  * 8MB is a pretty arbitrary value - it's big enough that it should last a while
  * and small enough that a mostly-unused one doesn't waste *too* much. It's
  * also a nice power of two, of course. */
 #define WOF_BLOCK_SIZE (8 * 1024 * 1024)
 
-/* The header for an entire OS-level 'block' of memory */
-typedef struct _wof_block_hdr_t {
-    struct _wof_block_hdr_t *prev, *next;
-} wof_block_hdr_t;
-
-/* The header for a single 'chunk' of memory as returned from alloc/realloc.
- * The 'jumbo' flag indicates an allocation larger than a normal-sized block
- * would be capable of serving. If this is set, it is the only chunk in the
- * block and the other chunk header fields are irrelevant.
+/* wof_allocator_reserve touches a reserved block every this many bytes to
+ * fault it in. Touching more often than the real page size costs little. */
+#define WOF_PREFAULT_STRIDE 4096
+
+/* Ordinary blocks are coloured: the header of each one (and so its first
+ * chunk) starts a different multiple of WOF_COLOUR_STEP bytes into the block's
+ * memory, rotating through WOF_COLOUR_SPAN bytes or a sixteenth of the block
+ * size, whichever is less. Otherwise every block's header and first chunk sit
+ * at the same offset from a large power-of-two boundary, and all compete for
+ * the same few cache sets. The step is a cache line, and the span is a page,
+ * so the colouring never costs a page of memory. */
+#define WOF_COLOUR_STEP 64
+#define WOF_COLOUR_SPAN 4096
+
+/* The header for an entire OS-level 'block' of memory. The epoch is that of
+ * the allocator when the block was last initialized; if it does not match the
+ * allocator's current epoch then the block has not been touched since the last
+ * free_all, and its contents are garbage. The size is the number of bytes from
+ * the header to the end of the block, and the colour is the number of bytes of
+ * the block's memory before the header (see WOF_COLOUR_STEP); the source
+ * handed out size + colour bytes starting colour bytes before the header. Only
+ * ordinary blocks are ever coloured, but a jumbo block that was promoted from
+ * an ordinary one keeps its colour, and in a pool with the small-object layer
+ * every block is placed this way (see WOF_SLAB_SIZE). Jumbo blocks are never
+ * reinitialized, so their epoch instead records how many marks the allocator
+ * had taken when they were allocated (see wof_mark).
+ *
+ * A pinned block is part of a reservation (see wof_allocator_reserve), and is
+ * never given back or purged by wof_gc and wof_gc_trim.
+ *
+ * With WOF_THREADS, each block also records the allocator that owns it, and
+ * has a list of its chunks that other threads have freed but which the owner
+ * has not yet taken back. A block with a non-empty remote list is also pushed
+ * onto its owner's list of such blocks (linked through remote_next).
  */
-typedef struct _wof_chunk_hdr_t {
-    int prev;
-
-    /* flags */
-    int last:1;
-    int used:1;
-    int jumbo:1;
-
-    int len:29;
-} wof_chunk_hdr_t;
-
-/* Handy macros for navigating the chunks in a block as if they were a
- * doubly-linked list. */
-#define WOF_CHUNK_PREV(CHUNK) ((CHUNK)->prev \
-        ? ((wof_chunk_hdr_t*)(((unsigned char*)(CHUNK)) - (CHUNK)->prev)) \
-        : NULL)
-
-#define WOF_CHUNK_NEXT(CHUNK) ((CHUNK)->last \
-        ? NULL \
-        : ((wof_chunk_hdr_t*)(((unsigned char*)(CHUNK)) + (CHUNK)->len)))
-
-#define WOF_CHUNK_HEADER_SIZE WOF_ALIGN_SIZE(sizeof(wof_chunk_hdr_t))
+struct _wof_block_hdr_t {
+    struct _wof_block_hdr_t  *prev, *next;
+    unsigned long             epoch;
+    size_t                    size;
+    size_t                    colour;
+    BOOL                      pinned;
+#ifdef WOF_THREADS
+    struct _wof_allocator_t  *owner;
+    struct _wof_chunk_hdr_t  *remote;
+    struct _wof_block_hdr_t  *remote_next;
+#endif /* WOF_THREADS */
+};
 
-/* other handy chunk macros */
-#define WOF_CHUNK_TO_DATA(CHUNK)  ((void*)((unsigned char*)(CHUNK) + WOF_CHUNK_HEADER_SIZE))
-#define WOF_DATA_TO_CHUNK(DATA)   ((wof_chunk_hdr_t*)((unsigned char*)(DATA) - WOF_CHUNK_HEADER_SIZE))
-#define WOF_CHUNK_DATA_LEN(CHUNK) ((CHUNK)->len - WOF_CHUNK_HEADER_SIZE)
+/* Records the offset of a chunk from the start of its block, if we are
+ * keeping track of it. */
+#ifdef WOF_THREADS
+#define WOF_CHUNK_SET_BLOCK(CHUNK, OFFSET) ((CHUNK)->block = (int)(OFFSET))
+#define WOF_CHUNK_OWNING_BLOCK(CHUNK) \
+        ((wof_block_hdr_t*)(((unsigned char*)(CHUNK)) - (CHUNK)->block))
+#else
+#define WOF_CHUNK_SET_BLOCK(CHUNK, OFFSET)
+#endif /* WOF_THREADS */
 
 /* some handy block macros */
 #define WOF_BLOCK_HEADER_SIZE     WOF_ALIGN_SIZE(sizeof(wof_block_hdr_t))
 #define WOF_BLOCK_TO_CHUNK(BLOCK) ((wof_chunk_hdr_t*)((unsigned char*)(BLOCK) + WOF_BLOCK_HEADER_SIZE))
 #define WOF_CHUNK_TO_BLOCK(CHUNK) ((wof_block_hdr_t*)((unsigned char*)(CHUNK) - WOF_BLOCK_HEADER_SIZE))
+#define WOF_JUMBO_TO_BLOCK(CHUNK) WOF_CHUNK_TO_BLOCK((unsigned char*)(CHUNK) - (CHUNK)->prev)
 
-#define WOF_BLOCK_MAX_ALLOC_SIZE (WOF_BLOCK_SIZE - \
+#define WOF_BLOCK_MAX_ALLOC_SIZE(ALLOCATOR) ((ALLOCATOR)->block_size - \
+        (ALLOCATOR)->max_colour - \
         (WOF_BLOCK_HEADER_SIZE + WOF_CHUNK_HEADER_SIZE))
 
-/* This is what the 'data' section of a chunk contains if it is free. */
-typedef struct _wof_free_hdr_t {
-    wof_chunk_hdr_t *prev, *next;
-} wof_free_hdr_t;
+/* Requests of up to WOF_SMALL_MAX_SIZE bytes are rounded up to the alignment
+ * amount, which gives the small-object layer one size class per multiple of
+ * it. */
+#define WOF_SMALL_CLASSES  (WOF_SMALL_MAX_SIZE / WOF_ALIGN_AMOUNT)
+#define WOF_SMALL_CLASS(SIZE) ((WOF_ALIGN_SIZE(SIZE) / WOF_ALIGN_AMOUNT) - 1)
+#define WOF_SMALL_OBJ_SIZE(CLASS) (((CLASS) + 1) * WOF_ALIGN_AMOUNT)
+
+/* The smallest capacity a string buffer is given. */
+#define WOF_STRBUF_MIN_SIZE 64
+
+/* Small objects are carved out of slabs, each of which fills exactly one
+ * WOF_SLAB_SIZE-aligned unit of a block. A slab is an ordinary chunk whose
+ * data starts on a unit boundary and runs up to the chunk header of whatever
+ * follows it, so slabs taken one after another from the same free chunk pack
+ * back to back. The data starts with a slab header, which any object pointer
+ * can be mapped back to by masking off the low bits. */
+#define WOF_SLAB_SIZE (4 * 1024)
+#define WOF_PTR_TO_SLAB(PTR) ((wof_slab_hdr_t*)((size_t)(PTR) & \
+        ~((size_t)WOF_SLAB_SIZE - 1)))
+#define WOF_SLAB_HEADER_SIZE WOF_ALIGN_SIZE(sizeof(wof_slab_hdr_t))
+
+/* The header of a slab. A pointer that is not a small object masks to a unit
+ * boundary that holds anything at all (the data of the chunk the pointer is
+ * in, more often than not, which the caller may have filled with whatever it
+ * liked), so nothing read there is trusted by itself. A slab's index is its
+ * place in the small-object layer's own table of slabs, and the boundary is a
+ * slab only if that entry of the table points back at it. The index fits in
+ * the first WOF_FREE_HEADER_SIZE bytes, which is as much as can be read at a
+ * boundary that turns out to be the start of some chunk's data. */
+typedef struct _wof_slab_hdr_t {
+    size_t index;
+    size_t cls;
+} wof_slab_hdr_t;
+
+/* The state of a single size class. Objects that have been freed are kept in
+ * a singly-linked list threaded through their first word; objects that have
+ * never been handed out are bump-allocated from the most recent slab. */
+typedef struct _wof_small_class_t {
+    void          *free_list;
+    unsigned char *bump;
+    unsigned char *end;
+} wof_small_class_t;
+
+/* The state of the small-object layer, allocated only for allocators that
+ * have it enabled. The table of slabs lives outside the pool's blocks, where
+ * nothing the pool hands out can reach it; a reset empties it, which disowns
+ * every slab there was. */
+struct _wof_small_t {
+    wof_small_class_t  classes[WOF_SMALL_CLASSES];
+    wof_slab_hdr_t   **slabs;
+    size_t             n_slabs;
+    size_t             max_slabs;
+};
+
+/* Pools created with WOF_FLAG_TLSF_INDEX keep their free chunks in an index
+ * of segregated lists instead of the recycler, in the style of TLSF (Two-Level
+ * Segregated Fit). A chunk's length, in units of the alignment amount, picks a
+ * first-level list by its highest set bit, and a second-level list by the
+ * WOF_TLSF_SL_LOG2 bits below that (lengths of fewer than WOF_TLSF_SL_COUNT
+ * units all share first-level list 0, one unit per second-level list). Each
+ * list is doubly-linked and NULL-terminated through the free headers, and
+ * there is a bitmap of non-empty lists at each level, so finding a list of
+ * chunks that are all big enough for a request takes a couple of
+ * find-first-set operations. */
+#define WOF_TLSF_SL_LOG2  4
+#define WOF_TLSF_SL_COUNT (1 << WOF_TLSF_SL_LOG2)
+#define WOF_TLSF_FL_COUNT 24
+
+struct _wof_tlsf_t {
+    unsigned long    fl_bitmap;
+    unsigned long    sl_bitmap[WOF_TLSF_FL_COUNT];
+    wof_chunk_hdr_t *lists[WOF_TLSF_FL_COUNT][WOF_TLSF_SL_COUNT];
+};
+
+/* Index of the lowest and highest set bits of a non-zero value. */
+#if defined(__GNUC__)
+#define WOF_FFS(X) ((size_t)__builtin_ctzl(X))
+#define WOF_FLS(X) ((size_t)(sizeof(unsigned long) * 8 - 1 - __builtin_clzl(X)))
+#else
+static size_t
+wof_ffs(unsigned long x)
+{
+    size_t i = 0;
 
-/* Handy macro for accessing the free-header of a chunk */
-#define WOF_GET_FREE(CHUNK) ((wof_free_hdr_t*)WOF_CHUNK_TO_DATA(CHUNK))
+    while (!(x & 1)) {
+        x >>= 1;
+        i++;
+    }
+    return i;
+}
 
-/* The size of the free header does not need to be aligned, as it is never used
- * in any way that would affect the alignment of the memory returned from
- * wof_alloc. This macro is defined just for consistency with all the other
- * WOF_*_SIZE macros (which do need to be aligned). */
-#define WOF_FREE_HEADER_SIZE sizeof(wof_free_hdr_t)
+static size_t
+wof_fls(unsigned long x)
+{
+    size_t i = 0;
 
-struct _wof_allocator_t {
-    wof_block_hdr_t *block_list;
-    wof_chunk_hdr_t *master_head;
-    wof_chunk_hdr_t *recycler_head;
+    while (x >>= 1) {
+        i++;
+    }
+    return i;
+}
+#define WOF_FFS(X) wof_ffs(X)
+#define WOF_FLS(X) wof_fls(X)
+#endif /* __GNUC__ */
+
+/* When built with WOF_TRACE, a pool that is being traced keeps a map from each
+ * live pointer it has handed out to the ID of the object in the trace. The map
+ * is an open-addressed hash with linear probing; a NULL pointer marks an empty
+ * slot. Each entry also has the ID under which its memory was first handed
+ * out, which a realloc that does not move keeps, so that a release can tell
+ * which objects live in memory allocated since its mark. 'busy' is set while
+ * a traced call is running, so that the calls it makes internally (a realloc
+ * that moves, say) are not recorded as well. */
+#ifdef WOF_TRACE
+typedef struct _wof_trace_entry_t {
+    const void    *ptr;
+    unsigned long  id;
+    unsigned long  born;
+} wof_trace_entry_t;
+
+struct _wof_trace_t {
+    FILE              *out;
+    BOOL               busy;
+    unsigned long      next_id;
+    wof_trace_entry_t *map;
+    size_t             count;
+    size_t             capacity;
 };
 
-/* MASTER/RECYCLER HELPERS */
+#define WOF_TRACING(ALLOCATOR) ((ALLOCATOR)->trace && \
+        !(ALLOCATOR)->trace->busy)
+#endif /* WOF_TRACE */
+
+/* A mark lives in the data of its 'fence': a used chunk carved off the front
+ * of the master head when the mark is taken. While any mark is active, every
+ * allocation is carved from the master, so whatever was allocated since the
+ * mark lies between the fence and the end that the master chunk had at the
+ * time, or else in a block that has been brought to the front of the block
+ * list since (see wof_enter_block), in front of `newest`. The fence is never
+ * freed until the mark is released, so nothing merges across it. Jumbo blocks
+ * allocated since the mark are those stamped with a sequence number of at
+ * least `seq`. The nofree arena in use when the mark was taken is put aside,
+ * so that the objects after the mark get one of their own, and is picked up
+ * again on release. */
+struct _wof_mark_t {
+    struct _wof_mark_t *prev;
+    unsigned char      *end;
+    wof_block_hdr_t    *newest;
+    wof_chunk_hdr_t    *nofree_arena;
+    unsigned long       seq;
+#ifdef WOF_TRACE
+    unsigned long       trace_id;
+#endif /* WOF_TRACE */
+};
 
-/* Cycles the recycler. See the design notes in the readme for more details. */
-static void
-wof_cycle_recycler(wof_allocator_t *allocator)
-{
-    wof_chunk_hdr_t *chunk;
-    wof_free_hdr_t  *free_chunk;
+/* A ring is a fixed number of generations, each with a pool of its own.
+ * Packets are assigned to the current generation until it has had its share,
+ * and then to the next one, once every packet of that has retired. 'refs'
+ * counts the packets of a generation that are still in flight (with
+ * WOF_THREADS they may be retired from any thread, so it is updated
+ * atomically), 'packets' counts those assigned since the generation was
+ * opened, and 'dirty' is set once its pool has been used since it was last
+ * emptied. Every pool gets its blocks through the ring's depot, so the blocks
+ * of an emptied generation go to whichever generation next needs them. */
+typedef struct _wof_ring_gen_t {
+    wof_allocator_t *pool;
+    size_t           refs;
+    size_t           packets;
+    BOOL             dirty;
+} wof_ring_gen_t;
+
+struct _wof_ring_t {
+    wof_ring_gen_t *gens;
+    size_t          count;
+    size_t          current;
+    size_t          per_generation;
+    wof_depot_t     depot;
+};
 
-    chunk = allocator->recycler_head;
+#ifdef WOF_THREADS
+#define WOF_RING_REFS(GEN) WOF_ATOMIC_LOAD(&(GEN)->refs)
+#else /* WOF_THREADS */
+#define WOF_RING_REFS(GEN) ((GEN)->refs)
+#endif /* WOF_THREADS */
 
-    if (chunk == NULL) {
-        return;
-    }
+/* BLOCK SOURCES */
 
-    free_chunk = WOF_GET_FREE(chunk);
+/* Every OS-level block (jumbo or not) is obtained from and returned to the
+ * allocator's block source. The default source is a thin wrapper around
+ * malloc or, with WOF_USE_MMAP, gives each block its own anonymous mapping. */
 
-    if (free_chunk->next->len < chunk->len) {
-        /* Hold the current head fixed during rotation. */
-        WOF_GET_FREE(free_chunk->next)->prev = free_chunk->prev;
-        WOF_GET_FREE(free_chunk->prev)->next = free_chunk->next;
+#ifdef WOF_USE_MMAP
 
-        free_chunk->prev = free_chunk->next;
-        free_chunk->next = WOF_GET_FREE(free_chunk->next)->next;
+static size_t
+wof_os_page_size(void)
+{
+    static size_t page_size = 0;
 
-        WOF_GET_FREE(free_chunk->next)->prev = chunk;
-        WOF_GET_FREE(free_chunk->prev)->next = chunk;
-    }
-    else {
-        /* Just rotate everything. */
-        allocator->recycler_head = free_chunk->next;
+    if (page_size == 0) {
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
     }
+
+    return page_size;
 }
 
-/* Adds a chunk from the recycler. */
-static void
-wof_add_to_recycler(wof_allocator_t *allocator,
-                    wof_chunk_hdr_t *chunk)
+static void *
+wof_os_get_block(void *ctx, const size_t size)
 {
-    wof_free_hdr_t *free_chunk;
-
-    if (WOF_CHUNK_DATA_LEN(chunk) < WOF_FREE_HEADER_SIZE) {
-        return;
-    }
+    void *ptr;
 
-    free_chunk = WOF_GET_FREE(chunk);
+    (void)ctx;
 
-    if (! allocator->recycler_head) {
-        /* First one */
-        free_chunk->next         = chunk;
-        free_chunk->prev         = chunk;
-        allocator->recycler_head = chunk;
-    }
-    else {
-        free_chunk->next = allocator->recycler_head;
-        free_chunk->prev = WOF_GET_FREE(allocator->recycler_head)->prev;
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-        WOF_GET_FREE(free_chunk->next)->prev = chunk;
-        WOF_GET_FREE(free_chunk->prev)->next = chunk;
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
 
-        if (chunk->len > allocator->recycler_head->len) {
-            allocator->recycler_head = chunk;
-        }
-    }
+static void
+wof_os_release_block(void *ctx, void *block, const size_t size)
+{
+    (void)ctx;
+    munmap(block, size);
 }
 
-/* Removes a chunk from the recycler. */
+/* Hands the whole pages (of the given size) within the range back to the OS
+ * without unmapping them. They read back as zeroes (or as their old contents,
+ * with MADV_FREE) the next time they are touched. */
 static void
-wof_remove_from_recycler(wof_allocator_t *allocator,
-                         wof_chunk_hdr_t *chunk)
+wof_os_purge_pages(void *start, const size_t len, const size_t page_size)
 {
-    wof_free_hdr_t *free_chunk;
+    size_t from, to;
 
-    free_chunk = WOF_GET_FREE(chunk);
+    from = ((size_t)start + page_size - 1) & ~(page_size - 1);
+    to   = ((size_t)start + len) & ~(page_size - 1);
 
-    if (free_chunk->prev == chunk && free_chunk->next == chunk) {
-        /* Only one item in recycler, just empty it. */
-        allocator->recycler_head = NULL;
-    }
-    else {
-        /* Two or more items, usual doubly-linked-list removal. It's circular
-         * so we don't need to worry about null-checking anything, which is
-         * nice. */
-        WOF_GET_FREE(free_chunk->prev)->next = free_chunk->next;
-        WOF_GET_FREE(free_chunk->next)->prev = free_chunk->prev;
-        if (allocator->recycler_head == chunk) {
-            allocator->recycler_head = free_chunk->next;
-        }
+    if (from >= to) {
+        return;
     }
+
+#if defined(WOF_USE_MADV_FREE) && defined(MADV_FREE)
+    madvise((void *)from, to - from, MADV_FREE);
+#else
+    madvise((void *)from, to - from, MADV_DONTNEED);
+#endif
 }
 
-/* Pushes a chunk onto the master stack. */
 static void
-wof_push_master(wof_allocator_t *allocator,
-                wof_chunk_hdr_t *chunk)
+wof_os_purge_block(void *ctx, void *start, const size_t len)
 {
-    wof_free_hdr_t *free_chunk;
-
-    free_chunk = WOF_GET_FREE(chunk);
-    free_chunk->prev = NULL;
-    free_chunk->next = allocator->master_head;
-    if (free_chunk->next) {
-        WOF_GET_FREE(free_chunk->next)->prev = chunk;
-    }
-    allocator->master_head = chunk;
+    (void)ctx;
+    wof_os_purge_pages(start, len, wof_os_page_size());
 }
 
-/* Removes the top chunk from the master stack. */
-static void
-wof_pop_master(wof_allocator_t *allocator)
+/* Where there is mremap, a block is resized by moving its pages rather than
+ * copying them, and shrinking one hands the pages past its new end back to
+ * the OS. Otherwise resizing falls back to mapping, copying and unmapping. */
+#ifdef MREMAP_MAYMOVE
+static void *
+wof_os_resize_block(void *ctx, void *block,
+                    const size_t old_size, const size_t new_size)
 {
-    wof_chunk_hdr_t *chunk;
-    wof_free_hdr_t  *free_chunk;
+    void *ptr;
 
-    chunk = allocator->master_head;
+    (void)ctx;
 
-    free_chunk = WOF_GET_FREE(chunk);
+    ptr = mremap(block, old_size, new_size, MREMAP_MAYMOVE);
 
-    allocator->master_head = free_chunk->next;
-    if (free_chunk->next) {
-        WOF_GET_FREE(free_chunk->next)->prev = NULL;
-    }
+    return ptr == MAP_FAILED ? NULL : ptr;
 }
+#endif /* MREMAP_MAYMOVE */
+
+static const wof_block_source_t wof_os_source = {
+    wof_os_get_block,
+    wof_os_release_block,
+#ifdef MREMAP_MAYMOVE
+    wof_os_resize_block,
+#else /* MREMAP_MAYMOVE */
+    NULL,
+#endif /* MREMAP_MAYMOVE */
+    wof_os_purge_block
+};
 
-/* CHUNK HELPERS */
+/* The source for pools created with WOF_FLAG_HUGE_PAGES. A block of at least
+ * a huge page comes from the kernel's reserved huge pages (MAP_HUGETLB) if it
+ * is a whole number of them and any are free. Otherwise it is mapped starting
+ * on a huge-page boundary and marked MADV_HUGEPAGE, so that transparent huge
+ * pages can back all of it; a block starting part way into a huge page could
+ * not use one for its first and last few megabytes. Purging works in whole
+ * huge pages, so as not to break them up. */
 
-/* Takes a free chunk and checks the chunks to its immediate right and left in
- * the block. If they are also free, the contigous free chunks are merged into
- * a single free chunk. The resulting chunk ends up in either the master list or
- * the recycler, depending on where the merged chunks were originally.
- */
-static void
-wof_merge_free(wof_allocator_t *allocator,
-               wof_chunk_hdr_t *chunk)
+#ifndef WOF_HUGE_PAGE_SIZE
+#define WOF_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif /* WOF_HUGE_PAGE_SIZE */
+
+#define WOF_PAGE_ROUND(SIZE, PAGE) (((SIZE) + (PAGE) - 1) & ~((PAGE) - 1))
+
+static void *
+wof_os_huge_get_block(void *ctx, const size_t size)
 {
-    wof_chunk_hdr_t *tmp;
-    wof_chunk_hdr_t *left_free  = NULL;
-    wof_chunk_hdr_t *right_free = NULL;
+    unsigned char *ptr, *block, *tail, *end;
+    size_t         page_size, map_size;
 
-    /* Check the chunk to our right. If it is free, merge it into our current
-     * chunk. If it is big enough to hold a free-header, save it for later (we
-     * need to know about the left chunk before we decide what goes where). */
-    tmp = WOF_CHUNK_NEXT(chunk);
-    if (tmp && !tmp->used) {
-        if (WOF_CHUNK_DATA_LEN(tmp) >= WOF_FREE_HEADER_SIZE) {
-            right_free = tmp;
-        }
-        chunk->len += tmp->len;
-        chunk->last = tmp->last;
+    if (size < WOF_HUGE_PAGE_SIZE) {
+        return wof_os_get_block(ctx, size);
     }
 
-    /* Check the chunk to our left. If it is free, merge our current chunk into
-     * it (thus chunk = tmp). As before, save it if it has enough space to
-     * hold a free-header. */
-    tmp = WOF_CHUNK_PREV(chunk);
-    if (tmp && !tmp->used) {
-        if (WOF_CHUNK_DATA_LEN(tmp) >= WOF_FREE_HEADER_SIZE) {
-            left_free = tmp;
+#ifdef MAP_HUGETLB
+    if (size % WOF_HUGE_PAGE_SIZE == 0) {
+        ptr = (unsigned char *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            return ptr;
         }
-        tmp->len += chunk->len;
-        tmp->last = chunk->last;
-        chunk = tmp;
     }
+#endif /* MAP_HUGETLB */
 
-    /* The length of our chunk may have changed. If we have a chunk following,
-     * update its 'prev' count. */
-    if (!chunk->last) {
-        WOF_CHUNK_NEXT(chunk)->prev = chunk->len;
+    /* map enough extra to be able to trim the mapping down to an aligned
+     * one */
+    page_size = wof_os_page_size();
+    map_size  = WOF_PAGE_ROUND(size, page_size)
+        + WOF_HUGE_PAGE_SIZE - page_size;
+
+    ptr = (unsigned char *)wof_os_get_block(ctx, map_size);
+    if (ptr == NULL) {
+        return NULL;
     }
 
-    /* Now that the chunk headers are merged and consistent, we need to figure
-     * out what goes where in which free list. */
-    if (right_free && right_free == allocator->master_head) {
-        /* If we merged right, and that chunk was the head of the master list,
-         * then we leave the resulting chunk at the head of the master list. */
-        wof_free_hdr_t *moved;
-        if (left_free) {
-            wof_remove_from_recycler(allocator, left_free);
-        }
-        moved = WOF_GET_FREE(chunk);
-        moved->prev = NULL;
-        moved->next = WOF_GET_FREE(right_free)->next;
-        allocator->master_head = chunk;
-        if (moved->next) {
-            WOF_GET_FREE(moved->next)->prev = chunk;
-        }
+    block = (unsigned char *)WOF_PAGE_ROUND((size_t)ptr,
+            (size_t)WOF_HUGE_PAGE_SIZE);
+    tail  = block + WOF_PAGE_ROUND(size, page_size);
+    end   = ptr + map_size;
+
+    if (block > ptr) {
+        munmap(ptr, (size_t)(block - ptr));
     }
-    else {
-        /* Otherwise, we remove the right-merged chunk (if there was one) from
-         * the recycler. Then, if we merged left we have nothing to do, since
-         * that recycler entry is still valid. If not, we add the chunk. */
-        if (right_free) {
-            wof_remove_from_recycler(allocator, right_free);
-        }
-        if (!left_free) {
-            wof_add_to_recycler(allocator, chunk);
-        }
+    if (end > tail) {
+        munmap(tail, (size_t)(end - tail));
     }
+
+#ifdef MADV_HUGEPAGE
+    madvise(block, size, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+
+    return block;
 }
 
-/* Takes an unused chunk and a size, and splits it into two chunks if possible.
- * The first chunk (at the same address as the input chunk) is guaranteed to
- * hold at least `size` bytes of data, and to not be in either the master or
- * recycler lists.
- *
- * The second chunk gets whatever data is left over. It is marked unused and
- * replaces the input chunk in whichever list it originally inhabited. */
 static void
-wof_split_free_chunk(wof_allocator_t *allocator,
-                     wof_chunk_hdr_t *chunk,
-                     const size_t size)
+wof_os_huge_purge_block(void *ctx, void *start, const size_t len)
 {
-    wof_chunk_hdr_t *extra;
-    wof_free_hdr_t  *old_blk, *new_blk;
-    size_t aligned_size, available;
-    BOOL last;
+    (void)ctx;
+    wof_os_purge_pages(start, len, WOF_HUGE_PAGE_SIZE);
+}
 
-    aligned_size = WOF_ALIGN_SIZE(size) + WOF_CHUNK_HEADER_SIZE;
+static const wof_block_source_t wof_os_huge_source = {
+    wof_os_huge_get_block,
+    wof_os_release_block,
+#ifdef MREMAP_MAYMOVE
+    wof_os_resize_block,
+#else /* MREMAP_MAYMOVE */
+    NULL,
+#endif /* MREMAP_MAYMOVE */
+    wof_os_huge_purge_block
+};
 
-    if (WOF_CHUNK_DATA_LEN(chunk) < aligned_size + WOF_FREE_HEADER_SIZE) {
-        /* If the available space is not enought to store all of
-         * (hdr + requested size + alignment padding + hdr + free-header) then
-         * just remove the current chunk from the free list and return, since we
-         * can't usefully split it. */
-        if (chunk == allocator->master_head) {
-            wof_pop_master(allocator);
-        }
-        else if (WOF_CHUNK_DATA_LEN(chunk) >= WOF_FREE_HEADER_SIZE) {
-            wof_remove_from_recycler(allocator, chunk);
-        }
-        return;
-    }
+#else /* WOF_USE_MMAP */
 
-    /* preserve a few values from chunk that we'll need to manipulate */
-    last      = chunk->last;
-    available = chunk->len - aligned_size;
+static void *
+wof_os_get_block(void *ctx, const size_t size)
+{
+    (void)ctx;
+    return malloc(size);
+}
 
-    /* set new values for chunk */
-    chunk->len  = (int) aligned_size;
-    chunk->last = FALSE;
+static void
+wof_os_release_block(void *ctx, void *block, const size_t size)
+{
+    (void)ctx;
+    (void)size;
+    free(block);
+}
 
-    /* with chunk's values set, we can use the standard macro to calculate
-     * the location and size of the new free chunk */
-    extra = WOF_CHUNK_NEXT(chunk);
+static void *
+wof_os_resize_block(void *ctx, void *block,
+                    const size_t old_size, const size_t new_size)
+{
+    (void)ctx;
+    (void)old_size;
+    return realloc(block, new_size);
+}
 
-    /* Now we move the free chunk's address without changing its location
-     * in whichever list it is in.
-     *
-     * Note that the new chunk header 'extra' may overlap the old free header,
-     * so we have to copy the free header before we write anything to extra.
-     */
-    old_blk = WOF_GET_FREE(chunk);
-    new_blk = WOF_GET_FREE(extra);
+/* There is no portable way to purge part of a malloc'd block. */
+static const wof_block_source_t wof_os_source = {
+    wof_os_get_block,
+    wof_os_release_block,
+    wof_os_resize_block,
+    NULL
+};
 
-    if (allocator->master_head == chunk) {
-        new_blk->prev = old_blk->prev;
-        new_blk->next = old_blk->next;
+#endif /* WOF_USE_MMAP */
 
-        if (old_blk->next) {
-            WOF_GET_FREE(old_blk->next)->prev = extra;
-        }
+/* The fixed-buffer source hands out pieces of a caller-supplied buffer. Pieces
+ * that are released are kept on a list (threaded through their first two
+ * words) and reused for later requests of exactly the same size, which is
+ * what the blocks of a single pool always ask for. */
 
-        allocator->master_head = extra;
-    }
-    else {
-        if (old_blk->prev == chunk) {
-            new_blk->prev = extra;
-            new_blk->next = extra;
-        }
-        else {
-            new_blk->prev = old_blk->prev;
-            new_blk->next = old_blk->next;
+typedef struct _wof_fixed_piece_t {
+    struct _wof_fixed_piece_t *next;
+    size_t                     size;
+} wof_fixed_piece_t;
 
-            WOF_GET_FREE(old_blk->prev)->next = extra;
-            WOF_GET_FREE(old_blk->next)->prev = extra;
+static void *
+wof_fixed_get_block(void *ctx, const size_t size)
+{
+    wof_fixed_source_t *fixed;
+    wof_fixed_piece_t **link, *piece;
+    size_t              aligned_size;
+    void               *block;
+
+    fixed = (wof_fixed_source_t *)ctx;
+    aligned_size = WOF_ALIGN_SIZE(size);
+
+    for (link = (wof_fixed_piece_t **)&fixed->released; *link;
+            link = &(*link)->next) {
+        if ((*link)->size == aligned_size) {
+            piece = *link;
+            *link = piece->next;
+            return piece;
         }
+    }
 
-        if (allocator->recycler_head == chunk) {
-            allocator->recycler_head = extra;
-        }
+    if ((size_t)(fixed->end - fixed->next) < aligned_size) {
+        return NULL;
     }
 
-    /* Now that we've copied over the free-list stuff (which may have overlapped
-     * with our new chunk header) we can safely write our new chunk header. */
-    extra->len   = (int) available;
-    extra->last  = last;
-    extra->prev  = chunk->len;
-    extra->used  = FALSE;
-    extra->jumbo = FALSE;
+    block = fixed->next;
+    fixed->next += aligned_size;
 
-    /* Correctly update the following chunk's back-pointer */
-    if (!last) {
-        WOF_CHUNK_NEXT(extra)->prev = extra->len;
-    }
+    return block;
 }
 
-/* Takes a used chunk and a size, and splits it into two chunks if possible.
- * The first chunk can hold at least `size` bytes of data, while the second gets
- * whatever's left over. The second is marked as unused and is added to the
- * recycler. */
 static void
-wof_split_used_chunk(wof_allocator_t *allocator,
-                     wof_chunk_hdr_t *chunk,
-                     const size_t size)
+wof_fixed_release_block(void *ctx, void *block, const size_t size)
 {
-    wof_chunk_hdr_t *extra;
-    size_t aligned_size, available;
-    BOOL last;
+    wof_fixed_source_t *fixed;
+    wof_fixed_piece_t  *piece;
+    size_t              aligned_size;
 
-    aligned_size = WOF_ALIGN_SIZE(size) + WOF_CHUNK_HEADER_SIZE;
+    fixed = (wof_fixed_source_t *)ctx;
+    aligned_size = WOF_ALIGN_SIZE(size);
 
-    if (aligned_size > WOF_CHUNK_DATA_LEN(chunk)) {
-        /* in this case we don't have enough space to really split it, so
-         * it's basically a no-op */
+    if ((unsigned char *)block + aligned_size == fixed->next) {
+        /* the most recent piece, so just wind the buffer back */
+        fixed->next = (unsigned char *)block;
         return;
     }
-    /* otherwise, we have room to split it, though the remaining free chunk
-     * may still not be usefully large */
 
-    /* preserve a few values from chunk that we'll need to manipulate */
-    last      = chunk->last;
-    available = chunk->len - aligned_size;
+    piece = (wof_fixed_piece_t *)block;
+    piece->size = aligned_size;
+    piece->next = (wof_fixed_piece_t *)fixed->released;
+    fixed->released = piece;
+}
 
-    /* set new values for chunk */
-    chunk->len  = (int) aligned_size;
-    chunk->last = FALSE;
+const wof_block_source_t wof_fixed_source = {
+    wof_fixed_get_block,
+    wof_fixed_release_block,
+    NULL,
+    NULL
+};
 
-    /* with chunk's values set, we can use the standard macro to calculate
-     * the location and size of the new free chunk */
-    extra = WOF_CHUNK_NEXT(chunk);
+/* The depot keeps its blocks on a stack threaded through their first word.
+ * With WOF_THREADS the stack is guarded by a spinlock. A lock-free pop would
+ * have to read the next pointer of a block that another thread may already
+ * have popped and handed back to the OS, and is open to the ABA problem
+ * besides; the lock is only ever held for a push or a pop, which are a few
+ * instructions each, and is only taken when a pool gets or gives back a
+ * whole block. */
 
-    /* set the new values for the chunk */
-    extra->len   = (int) available;
-    extra->last  = last;
-    extra->prev  = chunk->len;
-    extra->used  = FALSE;
-    extra->jumbo = FALSE;
+typedef struct _wof_depot_node_t {
+    struct _wof_depot_node_t *next;
+} wof_depot_node_t;
 
-    /* Correctly update the following chunk's back-pointer */
-    if (!last) {
-        WOF_CHUNK_NEXT(extra)->prev = extra->len;
+static void
+wof_depot_lock(wof_depot_t *depot)
+{
+#ifdef WOF_THREADS
+    while (WOF_ATOMIC_EXCHANGE(&depot->lock, 1)) {
+        while (__atomic_load_n(&depot->lock, __ATOMIC_RELAXED)) {
+            /* spin until it looks free, without hogging the cache line */
+        }
     }
+#else /* WOF_THREADS */
+    (void)depot;
+#endif /* WOF_THREADS */
+}
 
-    /* Merge it to its right if possible (it can't be merged left, obviously).
-     * This also adds it to the recycler. */
-    wof_merge_free(allocator, extra);
+static void
+wof_depot_unlock(wof_depot_t *depot)
+{
+#ifdef WOF_THREADS
+    __atomic_store_n(&depot->lock, 0, __ATOMIC_RELEASE);
+#else /* WOF_THREADS */
+    (void)depot;
+#endif /* WOF_THREADS */
 }
 
-/* BLOCK HELPERS */
+/* Takes a place in the depot for a block, unless it is at its high-water
+ * mark. The count includes places taken for blocks not yet pushed. */
+static BOOL
+wof_depot_take_place(wof_depot_t *depot)
+{
+    BOOL taken;
+
+    wof_depot_lock(depot);
+    taken = depot->count < depot->high_water;
+    if (taken) {
+        depot->count++;
+    }
+    wof_depot_unlock(depot);
+
+    return taken;
+}
 
-/* Add a block to the allocator's embedded doubly-linked list of OS-level blocks
- * that it owns. */
+/* Pushes a block that has a place in the depot onto its stack. */
 static void
-wof_add_to_block_list(wof_allocator_t *allocator,
-                      wof_block_hdr_t *block)
+wof_depot_push(wof_depot_t *depot, void *block)
 {
-    block->prev = NULL;
-    block->next = allocator->block_list;
-    if (block->next) {
-        block->next->prev = block;
+    wof_depot_node_t *node;
+
+    node = (wof_depot_node_t *)block;
+
+    wof_depot_lock(depot);
+    node->next = (wof_depot_node_t *)depot->top;
+    depot->top = node;
+    wof_depot_unlock(depot);
+}
+
+/* Pops the top block off the depot's stack, or returns NULL. */
+static wof_depot_node_t *
+wof_depot_pop(wof_depot_t *depot)
+{
+    wof_depot_node_t *node;
+
+    wof_depot_lock(depot);
+    node = (wof_depot_node_t *)depot->top;
+    if (node) {
+        depot->top = node->next;
+        depot->count--;
+    }
+    wof_depot_unlock(depot);
+
+    return node;
+}
+
+static void *
+wof_depot_get_block(void *ctx, const size_t size)
+{
+    wof_depot_t      *depot;
+    wof_depot_node_t *node;
+
+    depot = (wof_depot_t *)ctx;
+
+    if (size == depot->block_size) {
+        node = wof_depot_pop(depot);
+        if (node) {
+            return node;
+        }
     }
-    allocator->block_list = block;
+
+    return depot->source->get_block(depot->source_ctx, size);
 }
 
-/* Remove a block from the allocator's embedded doubly-linked list of OS-level
- * blocks that it owns. */
 static void
-wof_remove_from_block_list(wof_allocator_t *allocator,
-                           wof_block_hdr_t *block)
+wof_depot_release_block(void *ctx, void *block, const size_t size)
 {
-    if (block->prev) {
-        block->prev->next = block->next;
+    wof_depot_t *depot;
+
+    depot = (wof_depot_t *)ctx;
+
+    if (size == depot->block_size && wof_depot_take_place(depot)) {
+        wof_depot_push(depot, block);
+        return;
     }
-    else {
-        allocator->block_list = block->next;
+
+    depot->source->release_block(depot->source_ctx, block, size);
+}
+
+/* Resizes with the underlying source if it can, and otherwise by hand through
+ * the depot (jumbo blocks are practically never the depot's size, though). */
+static void *
+wof_depot_resize_block(void *ctx, void *block,
+                       const size_t old_size, const size_t new_size)
+{
+    wof_depot_t *depot;
+    void        *new_block;
+
+    depot = (wof_depot_t *)ctx;
+
+    if (depot->source->resize_block) {
+        return depot->source->resize_block(depot->source_ctx, block,
+                old_size, new_size);
     }
 
-    if (block->next) {
-        block->next->prev = block->prev;
+    new_block = wof_depot_get_block(ctx, new_size);
+    if (new_block == NULL) {
+        return NULL;
     }
+
+    memcpy(new_block, block, old_size < new_size ? old_size : new_size);
+    wof_depot_release_block(ctx, block, old_size);
+
+    return new_block;
 }
 
-/* Initializes a single unused chunk at the beginning of the block, and
- * adds that chunk to the free list. */
+/* There is deliberately no purge_block, so that wof_gc_trim gives unused
+ * blocks to the depot (whole and still faulted in) instead of keeping them. */
+const wof_block_source_t wof_depot_source = {
+    wof_depot_get_block,
+    wof_depot_release_block,
+    wof_depot_resize_block,
+    NULL
+};
+
+#ifdef WOF_THREADS
+
+/* The reclaimer is a depot with a helper thread in front of it. Released
+ * blocks are pushed onto a lock-free handoff queue (the first push of a batch
+ * also wakes the helper), which is all the releasing thread pays for. The
+ * helper takes the whole queue at once and, for each block, either purges its
+ * pages and puts it in the depot for reuse (as long as the depot is below its
+ * high-water mark) or hands it back to the underlying source. Blocks are
+ * taken from the depot as usual. */
+struct _wof_reclaimer_t {
+    wof_depot_t      depot;
+    void            *queue;
+    BOOL             stop;
+    pthread_t        thread;
+    pthread_mutex_t  lock;
+    pthread_cond_t   wake;
+};
+
+/* A block waiting on the handoff queue. */
+typedef struct _wof_reclaim_node_t {
+    struct _wof_reclaim_node_t *next;
+    size_t                      size;
+} wof_reclaim_node_t;
+
+/* Deals with a batch of blocks taken off the handoff queue. */
 static void
-wof_init_block(wof_allocator_t *allocator,
-               wof_block_hdr_t *block)
+wof_reclaim_blocks(wof_reclaimer_t *reclaimer, wof_reclaim_node_t *node)
 {
-    wof_chunk_hdr_t *chunk;
+    wof_depot_t        *depot;
+    wof_reclaim_node_t *next;
+    size_t              size;
 
-    /* a new block contains one chunk, right at the beginning */
-    chunk = WOF_BLOCK_TO_CHUNK(block);
+    depot = &reclaimer->depot;
 
-    chunk->used  = FALSE;
-    chunk->jumbo = FALSE;
-    chunk->last  = TRUE;
-    chunk->prev  = 0;
-    chunk->len   = WOF_BLOCK_SIZE - WOF_BLOCK_HEADER_SIZE;
+    for (; node; node = next) {
+        next = node->next;
+        size = node->size;
 
-    /* now push that chunk onto the master list */
-    wof_push_master(allocator, chunk);
+        if (size == depot->block_size && wof_depot_take_place(depot)) {
+            if (depot->source->purge_block) {
+                depot->source->purge_block(depot->source_ctx,
+                        (unsigned char *)node + sizeof(wof_reclaim_node_t),
+                        size - sizeof(wof_reclaim_node_t));
+            }
+            wof_depot_push(depot, node);
+            continue;
+        }
+
+        depot->source->release_block(depot->source_ctx, node, size);
+    }
+}
+
+static void *
+wof_reclaimer_main(void *arg)
+{
+    wof_reclaimer_t *reclaimer;
+    BOOL             stop;
+
+    reclaimer = (wof_reclaimer_t *)arg;
+
+    do {
+        pthread_mutex_lock(&reclaimer->lock);
+        while (WOF_ATOMIC_LOAD(&reclaimer->queue) == NULL &&
+                !reclaimer->stop) {
+            pthread_cond_wait(&reclaimer->wake, &reclaimer->lock);
+        }
+        stop = reclaimer->stop;
+        pthread_mutex_unlock(&reclaimer->lock);
+
+        wof_reclaim_blocks(reclaimer, (wof_reclaim_node_t *)
+                WOF_ATOMIC_EXCHANGE(&reclaimer->queue, NULL));
+    } while (!stop);
+
+    return NULL;
+}
+
+static void *
+wof_reclaimer_get_block(void *ctx, const size_t size)
+{
+    return wof_depot_get_block(&((wof_reclaimer_t *)ctx)->depot, size);
 }
 
-/* Creates a new block, and initializes it. */
 static void
-wof_new_block(wof_allocator_t *allocator)
+wof_reclaimer_release_block(void *ctx, void *block, const size_t size)
+{
+    wof_reclaimer_t    *reclaimer;
+    wof_reclaim_node_t *node, *top;
+
+    reclaimer = (wof_reclaimer_t *)ctx;
+    node = (wof_reclaim_node_t *)block;
+    node->size = size;
+
+    top = (wof_reclaim_node_t *)WOF_ATOMIC_LOAD(&reclaimer->queue);
+    do {
+        node->next = top;
+    } while (!WOF_ATOMIC_CAS((wof_reclaim_node_t **)&reclaimer->queue,
+                &top, node));
+
+    if (top == NULL) {
+        /* Taking the lock means that the helper is either waiting, and gets
+         * the signal, or has yet to look at the queue, and sees the block. */
+        pthread_mutex_lock(&reclaimer->lock);
+        pthread_cond_signal(&reclaimer->wake);
+        pthread_mutex_unlock(&reclaimer->lock);
+    }
+}
+
+static void *
+wof_reclaimer_resize_block(void *ctx, void *block,
+                           const size_t old_size, const size_t new_size)
+{
+    wof_depot_t *depot;
+    void        *new_block;
+
+    depot = &((wof_reclaimer_t *)ctx)->depot;
+
+    if (depot->source->resize_block) {
+        return depot->source->resize_block(depot->source_ctx, block,
+                old_size, new_size);
+    }
+
+    new_block = wof_reclaimer_get_block(ctx, new_size);
+    if (new_block == NULL) {
+        return NULL;
+    }
+
+    memcpy(new_block, block, old_size < new_size ? old_size : new_size);
+    wof_reclaimer_release_block(ctx, block, old_size);
+
+    return new_block;
+}
+
+/* As with the depot, there is no purge_block, so wof_gc_trim hands unused
+ * blocks over to be purged in the background instead of purging them in
+ * place. */
+const wof_block_source_t wof_reclaimer_source = {
+    wof_reclaimer_get_block,
+    wof_reclaimer_release_block,
+    wof_reclaimer_resize_block,
+    NULL
+};
+
+#endif /* WOF_THREADS */
+
+/* Gets a block of `size` bytes from the allocator's source. */
+static wof_block_hdr_t *
+wof_source_get(wof_allocator_t *allocator, const size_t size)
 {
     wof_block_hdr_t *block;
 
-    /* allocate the new block and add it to the block list */
-    block = (wof_block_hdr_t *)malloc(WOF_BLOCK_SIZE);
+    block = (wof_block_hdr_t *)allocator->source->get_block(
+            allocator->source_ctx, size);
+
+    if (block) {
+        block->size   = size;
+        block->colour = 0;
+        allocator->stats.bytes_reserved += size;
+        if (allocator->hooks && allocator->hooks->acquire) {
+            allocator->hooks->acquire(allocator->hooks_ctx, allocator, block,
+                    size);
+        }
+    }
+
+    return block;
+}
+
+/* Gets an ordinary block from the allocator's source, and moves its header
+ * along by the next colour in the rotation. In a pool with the small-object
+ * layer, the header is instead moved along so that the data of the block's
+ * first chunk starts on a slab boundary, so that the block has no chunk below
+ * its first boundary and can start with a slab. That boundary is also kept at
+ * least a slab's length (less the alignment amount) into the block's memory,
+ * like a jumbo block's, so that a block promoted to a jumbo block still has
+ * the boundary below its data inside it once it is resized and moved. */
+static wof_block_hdr_t *
+wof_source_get_coloured(wof_allocator_t *allocator)
+{
+    wof_block_hdr_t *block;
+    size_t           colour;
+
+    block = wof_source_get(allocator, allocator->block_size);
 
     if (block == NULL) {
+        return NULL;
+    }
+
+    if (allocator->small) {
+        colour = (size_t)WOF_CHUNK_TO_DATA(WOF_BLOCK_TO_CHUNK(block));
+        colour = (WOF_SLAB_SIZE - (colour & (WOF_SLAB_SIZE - 1)))
+            & (WOF_SLAB_SIZE - 1);
+        if (colour + WOF_BLOCK_HEADER_SIZE + WOF_CHUNK_HEADER_SIZE <
+                WOF_SLAB_SIZE - WOF_ALIGN_AMOUNT) {
+            colour += WOF_SLAB_SIZE;
+        }
+    }
+    else {
+        colour = allocator->next_colour;
+        allocator->next_colour = colour < allocator->max_colour
+            ? colour + WOF_COLOUR_STEP : 0;
+    }
+
+    /* the bytes skipped over are not counted anywhere */
+    block = (wof_block_hdr_t *)((unsigned char *)block + colour);
+    block->size   = allocator->block_size - colour;
+    block->colour = colour;
+    allocator->stats.bytes_reserved -= colour;
+
+    return block;
+}
+
+/* Returns a block to the allocator's source. */
+static void
+wof_source_release(wof_allocator_t *allocator, wof_block_hdr_t *block)
+{
+    unsigned char *base = (unsigned char *)block - block->colour;
+    size_t         size = block->size + block->colour;
+
+    allocator->stats.bytes_reserved -= block->size;
+    if (allocator->hooks && allocator->hooks->release) {
+        allocator->hooks->release(allocator->hooks_ctx, allocator, base, size);
+    }
+    allocator->source->release_block(allocator->source_ctx, base, size);
+}
+
+/* Resizes a block, by hand if the source can't do it for us (or fails to).
+ * The contents are preserved (up to the smaller of the two sizes) but the
+ * block may move. Returns NULL, leaving the original alone, on failure. */
+static wof_block_hdr_t *
+wof_source_resize(wof_allocator_t *allocator,
+                  wof_block_hdr_t *block,
+                  const size_t size)
+{
+    wof_block_hdr_t *new_block;
+    unsigned char   *base, *old_base;
+    size_t           colour, old_size;
+
+    if (allocator->source->resize_block) {
+        /* the colour comes along with the rest of the block's memory */
+        colour   = block->colour;
+        old_base = (unsigned char *)block - colour;
+        old_size = block->size + colour;
+        base     = (unsigned char *)allocator->source->resize_block(
+                allocator->source_ctx, old_base, old_size, size + colour);
+        if (base) {
+            new_block = (wof_block_hdr_t *)(base + colour);
+            allocator->stats.bytes_reserved += size - new_block->size;
+            new_block->size = size;
+            if (allocator->hooks && allocator->hooks->release) {
+                allocator->hooks->release(allocator->hooks_ctx, allocator,
+                        old_base, old_size);
+            }
+            if (allocator->hooks && allocator->hooks->acquire) {
+                allocator->hooks->acquire(allocator->hooks_ctx, allocator,
+                        base, size + colour);
+            }
+            return new_block;
+        }
+        /* (a huge-page mapping, say, may not be remappable to an arbitrary
+         * size, so try the hard way before giving up) */
+    }
+
+    /* the colour comes along this way too */
+    colour    = block->colour;
+    new_block = wof_source_get(allocator, size + colour);
+    if (new_block == NULL) {
+        return NULL;
+    }
+
+    new_block = (wof_block_hdr_t *)((unsigned char *)new_block + colour);
+    allocator->stats.bytes_reserved -= colour;
+    memcpy(new_block, block, block->size < size ? block->size : size);
+    new_block->size   = size;
+    new_block->colour = colour;
+    wof_source_release(allocator, block);
+
+    return new_block;
+}
+
+/* Lets the source drop the contents of [start, end) within a block, if it
+ * knows how to. */
+static void
+wof_source_purge(wof_allocator_t *allocator, void *start, void *end)
+{
+    if (allocator->source->purge_block) {
+        allocator->source->purge_block(allocator->source_ctx, start,
+                (size_t)((unsigned char *)end - (unsigned char *)start));
+    }
+}
+
+/* FREE-CHUNK INDEX */
+
+/* Maps a length in alignment units to its first- and second-level lists. */
+static void
+wof_tlsf_mapping(const size_t units, size_t *fl, size_t *sl)
+{
+    size_t msb;
+
+    if (units < WOF_TLSF_SL_COUNT) {
+        *fl = 0;
+        *sl = units;
         return;
     }
 
-    wof_add_to_block_list(allocator, block);
+    msb = WOF_FLS((unsigned long)units);
+    *fl = msb - WOF_TLSF_SL_LOG2 + 1;
+    *sl = (units >> (msb - WOF_TLSF_SL_LOG2)) - WOF_TLSF_SL_COUNT;
+}
+
+/* Files a free chunk in the list for its length. */
+static void
+wof_tlsf_insert(wof_tlsf_t *tlsf, wof_chunk_hdr_t *chunk)
+{
+    wof_free_hdr_t *free_chunk;
+    size_t          fl, sl;
+
+    wof_tlsf_mapping(chunk->len / WOF_ALIGN_AMOUNT, &fl, &sl);
+
+    free_chunk = WOF_GET_FREE(chunk);
+    free_chunk->prev = NULL;
+    free_chunk->next = tlsf->lists[fl][sl];
+    if (free_chunk->next) {
+        WOF_GET_FREE(free_chunk->next)->prev = chunk;
+    }
+    tlsf->lists[fl][sl] = chunk;
+
+    tlsf->fl_bitmap     |= 1UL << fl;
+    tlsf->sl_bitmap[fl] |= 1UL << sl;
+}
+
+/* Takes a free chunk out of the index. Its length must not have changed since
+ * it was filed. */
+static void
+wof_tlsf_remove(wof_tlsf_t *tlsf, wof_chunk_hdr_t *chunk)
+{
+    wof_free_hdr_t *free_chunk;
+    size_t          fl, sl;
+
+    wof_tlsf_mapping(chunk->len / WOF_ALIGN_AMOUNT, &fl, &sl);
+
+    free_chunk = WOF_GET_FREE(chunk);
+    if (free_chunk->next) {
+        WOF_GET_FREE(free_chunk->next)->prev = free_chunk->prev;
+    }
+    if (free_chunk->prev) {
+        WOF_GET_FREE(free_chunk->prev)->next = free_chunk->next;
+    }
+    else {
+        tlsf->lists[fl][sl] = free_chunk->next;
+
+        if (tlsf->lists[fl][sl] == NULL) {
+            tlsf->sl_bitmap[fl] &= ~(1UL << sl);
+            if (tlsf->sl_bitmap[fl] == 0) {
+                tlsf->fl_bitmap &= ~(1UL << fl);
+            }
+        }
+    }
+}
+
+/* Finds a free chunk of at least `len` bytes (headers included), or returns
+ * NULL. The request is rounded up to the next list boundary, so that any
+ * chunk in the first non-empty list at or above it will do. The chunk is left
+ * in the index. */
+static wof_chunk_hdr_t *
+wof_tlsf_find(wof_tlsf_t *tlsf, const size_t len)
+{
+    unsigned long map;
+    size_t        units, fl, sl;
+
+    units = (len + WOF_ALIGN_AMOUNT - 1) / WOF_ALIGN_AMOUNT;
+    if (units >= WOF_TLSF_SL_COUNT) {
+        units += ((size_t)1 << (WOF_FLS((unsigned long)units)
+                    - WOF_TLSF_SL_LOG2)) - 1;
+    }
+
+    wof_tlsf_mapping(units, &fl, &sl);
+
+    if (fl >= WOF_TLSF_FL_COUNT) {
+        return NULL;
+    }
+
+    map = tlsf->sl_bitmap[fl] & (~0UL << sl);
+
+    if (map == 0) {
+        /* nothing at this level, so take the smallest list of the next
+         * non-empty level up */
+        map = tlsf->fl_bitmap & (~0UL << (fl + 1));
+        if (map == 0) {
+            return NULL;
+        }
+        fl  = WOF_FFS(map);
+        map = tlsf->sl_bitmap[fl];
+    }
+
+    sl = WOF_FFS(map);
+
+    return tlsf->lists[fl][sl];
+}
+
+/* Empties the index. */
+static void
+wof_tlsf_reset(wof_tlsf_t *tlsf)
+{
+    memset(tlsf, 0, sizeof(wof_tlsf_t));
+}
+
+/* BLOCK LIST HELPERS */
+
+/* Add a block to one of the allocator's embedded doubly-linked lists of
+ * OS-level blocks that it owns (either the block list or the jumbo list). */
+static void
+wof_add_to_block_list(wof_block_hdr_t **list,
+                      wof_block_hdr_t *block)
+{
+    block->prev = NULL;
+    block->next = *list;
+    if (block->next) {
+        block->next->prev = block;
+    }
+    *list = block;
+}
+
+/* Remove a block from one of the allocator's embedded doubly-linked lists of
+ * OS-level blocks that it owns. */
+static void
+wof_remove_from_block_list(wof_block_hdr_t **list,
+                           wof_block_hdr_t *block)
+{
+    if (block->prev) {
+        block->prev->next = block->next;
+    }
+    else {
+        *list = block->next;
+    }
+
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+}
+
+/* While a mark is active, every block that allocations move into is brought to
+ * the front of the block list, so that the blocks used since a mark was taken
+ * are always the ones in front of the block that was newest at the time. If
+ * that block is itself brought forward, the mark moves on to its successor. */
+static void
+wof_enter_block(wof_allocator_t *allocator,
+                wof_block_hdr_t *block)
+{
+    wof_mark_t *mark;
+
+    for (mark = allocator->marks; mark; mark = mark->prev) {
+        if (mark->newest == block) {
+            mark->newest = block->next;
+        }
+    }
+
+    wof_remove_from_block_list(&allocator->block_list, block);
+    wof_add_to_block_list(&allocator->block_list, block);
+}
+
+/* MASTER/RECYCLER HELPERS */
+
+/* Cycles the recycler. See the design notes in the readme for more details. */
+static void
+wof_cycle_recycler(wof_allocator_t *allocator)
+{
+    wof_chunk_hdr_t *chunk;
+    wof_free_hdr_t  *free_chunk;
+
+    chunk = allocator->recycler_head;
+
+    if (chunk == NULL) {
+        return;
+    }
+
+    free_chunk = WOF_GET_FREE(chunk);
+
+    if (free_chunk->next->len < chunk->len) {
+        /* Hold the current head fixed during rotation. */
+        WOF_GET_FREE(free_chunk->next)->prev = free_chunk->prev;
+        WOF_GET_FREE(free_chunk->prev)->next = free_chunk->next;
+
+        free_chunk->prev = free_chunk->next;
+        free_chunk->next = WOF_GET_FREE(free_chunk->next)->next;
+
+        WOF_GET_FREE(free_chunk->next)->prev = chunk;
+        WOF_GET_FREE(free_chunk->prev)->next = chunk;
+    }
+    else {
+        /* Just rotate everything. */
+        allocator->recycler_head = free_chunk->next;
+    }
+}
+
+/* Adds a chunk to the recycler (or to the index, if the pool has one). */
+static void
+wof_add_to_recycler(wof_allocator_t *allocator,
+                    wof_chunk_hdr_t *chunk)
+{
+    wof_free_hdr_t *free_chunk;
+
+    if (WOF_CHUNK_DATA_LEN(chunk) < WOF_FREE_HEADER_SIZE) {
+        return;
+    }
+
+    if (allocator->tlsf) {
+        wof_tlsf_insert(allocator->tlsf, chunk);
+        return;
+    }
+
+    free_chunk = WOF_GET_FREE(chunk);
+
+    if (! allocator->recycler_head) {
+        /* First one */
+        free_chunk->next         = chunk;
+        free_chunk->prev         = chunk;
+        allocator->recycler_head = chunk;
+    }
+    else {
+        free_chunk->next = allocator->recycler_head;
+        free_chunk->prev = WOF_GET_FREE(allocator->recycler_head)->prev;
+
+        WOF_GET_FREE(free_chunk->next)->prev = chunk;
+        WOF_GET_FREE(free_chunk->prev)->next = chunk;
+
+        if (chunk->len > allocator->recycler_head->len) {
+            allocator->recycler_head = chunk;
+        }
+    }
+}
+
+/* Removes a chunk from the recycler (or from the index). */
+static void
+wof_remove_from_recycler(wof_allocator_t *allocator,
+                         wof_chunk_hdr_t *chunk)
+{
+    wof_free_hdr_t *free_chunk;
+
+    if (allocator->tlsf) {
+        wof_tlsf_remove(allocator->tlsf, chunk);
+        return;
+    }
+
+    free_chunk = WOF_GET_FREE(chunk);
+
+    if (free_chunk->prev == chunk && free_chunk->next == chunk) {
+        /* Only one item in recycler, just empty it. */
+        allocator->recycler_head = NULL;
+    }
+    else {
+        /* Two or more items, usual doubly-linked-list removal. It's circular
+         * so we don't need to worry about null-checking anything, which is
+         * nice. */
+        WOF_GET_FREE(free_chunk->prev)->next = free_chunk->next;
+        WOF_GET_FREE(free_chunk->next)->prev = free_chunk->prev;
+        if (allocator->recycler_head == chunk) {
+            allocator->recycler_head = free_chunk->next;
+        }
+    }
+}
+
+/* Pushes a chunk onto the master stack. */
+static void
+wof_push_master(wof_allocator_t *allocator,
+                wof_chunk_hdr_t *chunk)
+{
+    wof_free_hdr_t *free_chunk;
+
+    free_chunk = WOF_GET_FREE(chunk);
+    free_chunk->prev = NULL;
+    free_chunk->next = allocator->master_head;
+    if (free_chunk->next) {
+        WOF_GET_FREE(free_chunk->next)->prev = chunk;
+    }
+    allocator->master_head = chunk;
+}
+
+/* Removes the top chunk from the master stack. Any chunk below the top is the
+ * whole of an unused block (see wof_release_to_mark), so if a mark is active
+ * the block of the new top is entered. */
+static void
+wof_pop_master(wof_allocator_t *allocator)
+{
+    wof_chunk_hdr_t *chunk;
+    wof_free_hdr_t  *free_chunk;
+
+    chunk = allocator->master_head;
+
+    free_chunk = WOF_GET_FREE(chunk);
+
+    allocator->master_head = free_chunk->next;
+    if (free_chunk->next) {
+        WOF_GET_FREE(free_chunk->next)->prev = NULL;
+
+        if (allocator->marks) {
+            wof_enter_block(allocator, WOF_CHUNK_TO_BLOCK(free_chunk->next));
+        }
+    }
+}
+
+/* Takes a free chunk out of whichever list it is in. A recycler chunk has
+ * neighbours just like a master chunk does, so the only way to tell which it
+ * is is to look for it in the master stack (which is rarely more than one
+ * chunk deep, except for the unused blocks a release leaves there). */
+static void
+wof_unlink_free_chunk(wof_allocator_t *allocator,
+                      wof_chunk_hdr_t *chunk)
+{
+    wof_chunk_hdr_t *cur;
+    wof_free_hdr_t  *free_chunk;
+
+    for (cur = allocator->master_head; cur; cur = WOF_GET_FREE(cur)->next) {
+        if (cur != chunk) {
+            continue;
+        }
+
+        free_chunk = WOF_GET_FREE(chunk);
+        if (free_chunk->prev) {
+            WOF_GET_FREE(free_chunk->prev)->next = free_chunk->next;
+        }
+        else {
+            allocator->master_head = free_chunk->next;
+        }
+        if (free_chunk->next) {
+            WOF_GET_FREE(free_chunk->next)->prev = free_chunk->prev;
+        }
+        return;
+    }
+
+    wof_remove_from_recycler(allocator, chunk);
+}
+
+/* CHUNK HELPERS */
+
+/* Takes a free chunk and checks the chunks to its immediate right and left in
+ * the block. If they are also free, the contigous free chunks are merged into
+ * a single free chunk. The resulting chunk ends up in either the master list or
+ * the recycler, depending on where the merged chunks were originally.
+ */
+static void
+wof_merge_free(wof_allocator_t *allocator,
+               wof_chunk_hdr_t *chunk)
+{
+    wof_chunk_hdr_t *tmp;
+    wof_chunk_hdr_t *left_free  = NULL;
+    wof_chunk_hdr_t *right_free = NULL;
+
+    /* Check the chunk to our right. If it is free, merge it into our current
+     * chunk. If it is big enough to hold a free-header, save it for later (we
+     * need to know about the left chunk before we decide what goes where). */
+    tmp = WOF_CHUNK_NEXT(chunk);
+    if (tmp && !tmp->used) {
+        if (WOF_CHUNK_DATA_LEN(tmp) >= WOF_FREE_HEADER_SIZE) {
+            right_free = tmp;
+            if (allocator->tlsf && tmp != allocator->master_head) {
+                /* the index is by length, so it has to come out now */
+                wof_remove_from_recycler(allocator, tmp);
+            }
+        }
+        chunk->len += tmp->len;
+        chunk->last = tmp->last;
+    }
+
+    /* Check the chunk to our left. If it is free, merge our current chunk into
+     * it (thus chunk = tmp). As before, save it if it has enough space to
+     * hold a free-header. */
+    tmp = WOF_CHUNK_PREV(chunk);
+    if (tmp && !tmp->used) {
+        if (WOF_CHUNK_DATA_LEN(tmp) >= WOF_FREE_HEADER_SIZE) {
+            left_free = tmp;
+            if (allocator->tlsf && tmp != allocator->master_head) {
+                wof_remove_from_recycler(allocator, tmp);
+            }
+        }
+        tmp->len += chunk->len;
+        tmp->last = chunk->last;
+        chunk = tmp;
+    }
+
+    /* The length of our chunk may have changed. If we have a chunk following,
+     * update its 'prev' count. */
+    if (!chunk->last) {
+        WOF_CHUNK_NEXT(chunk)->prev = chunk->len;
+    }
+
+    /* Now that the chunk headers are merged and consistent, we need to figure
+     * out what goes where in which free list. */
+    if (right_free && right_free == allocator->master_head) {
+        /* If we merged right, and that chunk was the head of the master list,
+         * then we leave the resulting chunk at the head of the master list. */
+        wof_free_hdr_t *moved;
+        if (left_free && !allocator->tlsf) {
+            wof_remove_from_recycler(allocator, left_free);
+        }
+        moved = WOF_GET_FREE(chunk);
+        moved->prev = NULL;
+        moved->next = WOF_GET_FREE(right_free)->next;
+        allocator->master_head = chunk;
+        if (moved->next) {
+            WOF_GET_FREE(moved->next)->prev = chunk;
+        }
+    }
+    else if (allocator->tlsf) {
+        /* Both neighbours were taken out of the index above, so the merged
+         * chunk just has to be filed (unless it is the master head, which
+         * it is if we merged into that from the right). */
+        if (chunk != allocator->master_head) {
+            wof_add_to_recycler(allocator, chunk);
+        }
+    }
+    else {
+        /* Otherwise, we remove the right-merged chunk (if there was one) from
+         * the recycler. Then, if we merged left we have nothing to do, since
+         * that recycler entry is still valid. If not, we add the chunk. */
+        if (right_free) {
+            wof_remove_from_recycler(allocator, right_free);
+        }
+        if (!left_free) {
+            wof_add_to_recycler(allocator, chunk);
+        }
+    }
+}
+
+/* Takes an unused chunk and a size, and splits it into two chunks if possible.
+ * The first chunk (at the same address as the input chunk) is guaranteed to
+ * hold at least `size` bytes of data, and to not be in either the master or
+ * recycler lists.
+ *
+ * The second chunk gets whatever data is left over. It is marked unused and
+ * replaces the input chunk in whichever list it originally inhabited. */
+static void
+wof_split_free_chunk(wof_allocator_t *allocator,
+                     wof_chunk_hdr_t *chunk,
+                     const size_t size)
+{
+    wof_chunk_hdr_t *extra;
+    wof_free_hdr_t  *old_blk, *new_blk;
+    size_t aligned_size, available;
+    BOOL last;
+
+    aligned_size = WOF_ALIGN_SIZE(size) + WOF_CHUNK_HEADER_SIZE;
+
+    if (WOF_CHUNK_DATA_LEN(chunk) < aligned_size + WOF_FREE_HEADER_SIZE) {
+        /* If the available space is not enought to store all of
+         * (hdr + requested size + alignment padding + hdr + free-header) then
+         * just remove the current chunk from the free list and return, since we
+         * can't usefully split it. */
+        if (chunk == allocator->master_head) {
+            wof_pop_master(allocator);
+        }
+        else if (WOF_CHUNK_DATA_LEN(chunk) >= WOF_FREE_HEADER_SIZE) {
+            wof_remove_from_recycler(allocator, chunk);
+        }
+        return;
+    }
+
+    if (allocator->tlsf && chunk != allocator->master_head) {
+        /* The index is by length, so rather than moving the chunk's entry we
+         * take it out here and file the leftover chunk at the end. */
+        wof_remove_from_recycler(allocator, chunk);
+    }
+
+    /* preserve a few values from chunk that we'll need to manipulate */
+    last      = chunk->last;
+    available = chunk->len - aligned_size;
+
+    /* set new values for chunk */
+    chunk->len  = (int) aligned_size;
+    chunk->last = FALSE;
+
+    /* with chunk's values set, we can use the standard macro to calculate
+     * the location and size of the new free chunk */
+    extra = WOF_CHUNK_NEXT(chunk);
+
+    /* Now we move the free chunk's address without changing its location
+     * in whichever list it is in.
+     *
+     * Note that the new chunk header 'extra' may overlap the old free header,
+     * so we have to copy the free header before we write anything to extra.
+     */
+    old_blk = WOF_GET_FREE(chunk);
+    new_blk = WOF_GET_FREE(extra);
+
+    if (allocator->master_head == chunk) {
+        new_blk->prev = old_blk->prev;
+        new_blk->next = old_blk->next;
+
+        if (old_blk->next) {
+            WOF_GET_FREE(old_blk->next)->prev = extra;
+        }
+
+        allocator->master_head = extra;
+    }
+    else if (!allocator->tlsf) {
+        if (old_blk->prev == chunk) {
+            new_blk->prev = extra;
+            new_blk->next = extra;
+        }
+        else {
+            new_blk->prev = old_blk->prev;
+            new_blk->next = old_blk->next;
+
+            WOF_GET_FREE(old_blk->prev)->next = extra;
+            WOF_GET_FREE(old_blk->next)->prev = extra;
+        }
+
+        if (allocator->recycler_head == chunk) {
+            allocator->recycler_head = extra;
+        }
+    }
+
+    /* Now that we've copied over the free-list stuff (which may have overlapped
+     * with our new chunk header) we can safely write our new chunk header. */
+    extra->len   = (int) available;
+    extra->last  = last;
+    extra->prev  = chunk->len;
+    extra->used  = FALSE;
+    extra->jumbo = FALSE;
+    WOF_CHUNK_SET_BLOCK(extra, chunk->block + chunk->len);
+
+    /* Correctly update the following chunk's back-pointer */
+    if (!last) {
+        WOF_CHUNK_NEXT(extra)->prev = extra->len;
+    }
+
+    /* with an index, the leftover chunk can only be filed now that its
+     * header is written */
+    if (allocator->tlsf && extra != allocator->master_head) {
+        wof_add_to_recycler(allocator, extra);
+    }
+}
+
+/* Takes a used chunk and a size, and splits it into two chunks if possible.
+ * The first chunk can hold at least `size` bytes of data, while the second gets
+ * whatever's left over. The second is marked as unused and is added to the
+ * recycler. */
+static void
+wof_split_used_chunk(wof_allocator_t *allocator,
+                     wof_chunk_hdr_t *chunk,
+                     const size_t size)
+{
+    wof_chunk_hdr_t *extra;
+    size_t aligned_size, available;
+    BOOL last;
+
+    aligned_size = WOF_ALIGN_SIZE(size) + WOF_CHUNK_HEADER_SIZE;
+
+    if (aligned_size > WOF_CHUNK_DATA_LEN(chunk)) {
+        /* in this case we don't have enough space to really split it, so
+         * it's basically a no-op */
+        return;
+    }
+    /* otherwise, we have room to split it, though the remaining free chunk
+     * may still not be usefully large */
+
+    /* preserve a few values from chunk that we'll need to manipulate */
+    last      = chunk->last;
+    available = chunk->len - aligned_size;
+
+    /* set new values for chunk */
+    chunk->len  = (int) aligned_size;
+    chunk->last = FALSE;
+    allocator->stats.bytes_in_use -= available;
+
+    /* with chunk's values set, we can use the standard macro to calculate
+     * the location and size of the new free chunk */
+    extra = WOF_CHUNK_NEXT(chunk);
+
+    /* set the new values for the chunk */
+    extra->len   = (int) available;
+    extra->last  = last;
+    extra->prev  = chunk->len;
+    extra->used  = FALSE;
+    extra->jumbo = FALSE;
+    WOF_CHUNK_SET_BLOCK(extra, chunk->block + chunk->len);
+
+    /* Correctly update the following chunk's back-pointer */
+    if (!last) {
+        WOF_CHUNK_NEXT(extra)->prev = extra->len;
+    }
+
+    /* Merge it to its right if possible (it can't be merged left, obviously).
+     * This also adds it to the recycler. */
+    wof_merge_free(allocator, extra);
+}
+
+/* Grows a used chunk in place to hold at least `size` bytes, by taking what it
+ * needs from the start of the chunk to its right, if that is free and big
+ * enough. Returns FALSE, having done nothing, otherwise. */
+static BOOL
+wof_grow_chunk(wof_allocator_t *allocator,
+               wof_chunk_hdr_t *chunk,
+               const size_t size)
+{
+    wof_chunk_hdr_t *tmp;
+    size_t           split_size;
+
+    tmp = WOF_CHUNK_NEXT(chunk);
+
+    if (!tmp || tmp->used || size >= WOF_CHUNK_DATA_LEN(chunk) + tmp->len) {
+        return FALSE;
+    }
+
+    /* we ask for the next chunk to be split, but we don't end up
+     * using the split chunk header (it just gets merged into this one),
+     * so we want the split to be of (size - curdatalen - header_size).
+     * However, this can underflow by header_size, so we do a quick
+     * check here and floor the value to 0. */
+    split_size = size - WOF_CHUNK_DATA_LEN(chunk);
+
+    if (split_size < WOF_CHUNK_HEADER_SIZE) {
+        split_size = 0;
+    }
+    else {
+        split_size -= WOF_CHUNK_HEADER_SIZE;
+    }
+
+    wof_split_free_chunk(allocator, tmp, split_size);
+
+    /* Now do a 'quickie' merge between the current block and the left-
+     * hand side of the split. Simply calling wof_merge_free
+     * might confuse things, since we may temporarily have two blocks
+     * to our right that are both free (and it isn't guaranteed to
+     * handle that case). Update our 'next' count and last flag, and
+     * our (new) successor's 'prev' count */
+    chunk->len += tmp->len;
+    chunk->last = tmp->last;
+    allocator->stats.bytes_in_use += tmp->len;
+    tmp = WOF_CHUNK_NEXT(chunk);
+    if (tmp) {
+        tmp->prev = chunk->len;
+    }
+
+    /* Now cycle the recycler */
+    wof_cycle_recycler(allocator);
+
+    return TRUE;
+}
+
+/* Merges a used chunk with the free chunk to its left (and the one to its
+ * right, if that is free too) when together they can hold `size` bytes, and
+ * moves the data down to the start of the merged chunk, which is returned.
+ * The caller should split off whatever is not needed. Returns NULL, having
+ * done nothing, if the chunks are not free or not big enough, or while any
+ * mark is active (so that an object made before a mark can't end up in
+ * memory that was free when the mark was taken). */
+static wof_chunk_hdr_t *
+wof_absorb_neighbours(wof_allocator_t *allocator,
+                      wof_chunk_hdr_t *chunk,
+                      const size_t size)
+{
+    wof_chunk_hdr_t *left, *right;
+    size_t           len, data_len;
+    BOOL             last;
+
+    left  = WOF_CHUNK_PREV(chunk);
+    right = WOF_CHUNK_NEXT(chunk);
+
+    if (allocator->marks || !left || left->used) {
+        return NULL;
+    }
+
+    if (right && right->used) {
+        right = NULL;
+    }
+
+    len = left->len + chunk->len + (right ? right->len : 0);
+    if (len - WOF_CHUNK_HEADER_SIZE < size) {
+        return NULL;
+    }
+
+    /* the neighbours have to come out of their lists before their headers
+     * change (or are overwritten) */
+    if (WOF_CHUNK_DATA_LEN(left) >= WOF_FREE_HEADER_SIZE) {
+        wof_unlink_free_chunk(allocator, left);
+    }
+    if (right && WOF_CHUNK_DATA_LEN(right) >= WOF_FREE_HEADER_SIZE) {
+        wof_unlink_free_chunk(allocator, right);
+    }
+
+    data_len = WOF_CHUNK_DATA_LEN(chunk);
+    last     = right ? right->last : chunk->last;
+
+    allocator->stats.bytes_in_use += len - chunk->len;
+
+    left->len  = (int) len;
+    left->last = last;
+    left->used = TRUE;
+
+    /* this overwrites the old chunk header, which is why we're done with it */
+    memmove(WOF_CHUNK_TO_DATA(left), WOF_CHUNK_TO_DATA(chunk), data_len);
+
+    if (!last) {
+        WOF_CHUNK_NEXT(left)->prev = left->len;
+    }
+
+    return left;
+}
+
+/* BLOCK HELPERS */
+
+/* Initializes a single unused chunk at the beginning of the block, and
+ * adds that chunk to the free list. */
+static void
+wof_init_block(wof_allocator_t *allocator,
+               wof_block_hdr_t *block)
+{
+    wof_chunk_hdr_t *chunk;
+
+    /* a new block contains one chunk, right at the beginning */
+    chunk = WOF_BLOCK_TO_CHUNK(block);
+
+    chunk->used  = FALSE;
+    chunk->jumbo = FALSE;
+    chunk->last  = TRUE;
+    chunk->prev  = 0;
+    chunk->len   = (int)(block->size - WOF_BLOCK_HEADER_SIZE);
+    WOF_CHUNK_SET_BLOCK(chunk, WOF_BLOCK_HEADER_SIZE);
+
+    /* it is now part of the current epoch, if it wasn't already (a block
+     * emptied by wof_release_to_mark was) */
+    if (block->epoch != allocator->epoch) {
+        block->epoch = allocator->epoch;
+        allocator->cur_blocks++;
+        if (allocator->cur_blocks > allocator->peak_blocks) {
+            allocator->peak_blocks = allocator->cur_blocks;
+        }
+    }
+
+    /* now push that chunk onto the master list */
+    wof_push_master(allocator, chunk);
+}
+
+/* Adds a block fresh from the source to the block list, and makes it
+ * available on the master list. */
+static void
+wof_add_block(wof_allocator_t *allocator,
+              wof_block_hdr_t *block)
+{
+#ifdef WOF_THREADS
+    block->owner  = allocator;
+    block->remote = NULL;
+#endif /* WOF_THREADS */
+
+    allocator->stats.blocks++;
+    allocator->stats.block_bytes += block->size;
+
+    /* no epoch is ever 0, so this is not yet part of any */
+    block->epoch = 0;
+
+    WOF_PROBE3(new_block, allocator, block, block->size);
+
+    wof_add_to_block_list(&allocator->block_list, block);
+
+    /* initialize it */
+    wof_init_block(allocator, block);
+}
+
+/* Makes a fresh block available on the master list. Stale blocks left over
+ * from before the last free_all are reinitialized and reused first; only if
+ * there are none do we create a new block. */
+static void
+wof_new_block(wof_allocator_t *allocator)
+{
+    wof_block_hdr_t *block;
+
+    if (allocator->stale) {
+        /* reinitializing the first stale block moves it into the run of
+         * current blocks without having to move it in the list */
+        block = allocator->stale;
+        allocator->stale = block->next;
+        if (allocator->marks) {
+            wof_enter_block(allocator, block);
+        }
+        wof_init_block(allocator, block);
+        return;
+    }
+
+    /* allocate the new block and add it to the block list */
+    block = wof_source_get_coloured(allocator);
+
+    if (block == NULL) {
+        return;
+    }
+
+    block->pinned = FALSE;
+    wof_add_block(allocator, block);
+}
+
+/* JUMBO ALLOCATIONS */
+
+/* Allocates special 'jumbo' blocks for sizes that won't fit normally. If
+ * `alignment` is more than WOF_ALIGN_AMOUNT, the block gets room to slide the
+ * chunk along until its data is suitably aligned. */
+static void *
+wof_alloc_jumbo(wof_allocator_t *allocator,
+                const size_t size,
+                const size_t alignment)
+{
+    wof_block_hdr_t   *block;
+    wof_chunk_hdr_t *chunk;
+    size_t           data, offset, colour, total;
+
+    /* A small-object pool reads the slab boundary below every pointer it is
+     * asked to free (see wof_small_slab), so there the block's header goes a
+     * slab's length into its memory, to keep that boundary inside it. The
+     * colour comes along if the block is ever resized. */
+    colour = allocator->small ? WOF_SLAB_SIZE : 0;
+
+    /* allocate a new block of exactly the right size */
+    total = colour + size
+        + WOF_BLOCK_HEADER_SIZE
+        + WOF_CHUNK_HEADER_SIZE
+        + (alignment - WOF_ALIGN_AMOUNT);
+    block = wof_source_get(allocator, total);
+
+    if (block == NULL) {
+        return NULL;
+    }
+
+    if (colour) {
+        /* the bytes skipped over are not counted anywhere */
+        block = (wof_block_hdr_t *)((unsigned char *)block + colour);
+        block->size   = total - colour;
+        block->colour = colour;
+        allocator->stats.bytes_reserved -= colour;
+    }
+
+#ifdef WOF_THREADS
+    block->owner  = allocator;
+    block->remote = NULL;
+#endif /* WOF_THREADS */
+
+    /* add it to the jumbo list, stamped for wof_release_to_mark */
+    block->epoch  = allocator->marks_taken;
+    block->pinned = FALSE;
+    wof_add_to_block_list(&allocator->jumbo_list, block);
+    allocator->stats.jumbo_blocks++;
+    allocator->stats.jumbo_bytes += block->size;
+
+    /* the new block contains a single jumbo chunk */
+    chunk  = WOF_BLOCK_TO_CHUNK(block);
+    data   = (size_t)WOF_CHUNK_TO_DATA(chunk);
+    offset = (alignment - (data & (alignment - 1))) & (alignment - 1);
+    chunk  = (wof_chunk_hdr_t *)((unsigned char *)chunk + offset);
+
+    chunk->last  = TRUE;
+    chunk->used  = TRUE;
+    chunk->jumbo = TRUE;
+    chunk->len   = 0;
+    chunk->prev  = (int)offset;
+    WOF_CHUNK_SET_BLOCK(chunk, WOF_BLOCK_HEADER_SIZE + offset);
+
+    WOF_PROBE3(jumbo, allocator, WOF_CHUNK_TO_DATA(chunk), size);
+
+    /* and return the data pointer */
+    return WOF_CHUNK_TO_DATA(chunk);
+}
+
+/* Turns the block holding a chunk into a jumbo block, with the chunk (whose
+ * data stays exactly where it is) as its jumbo chunk. This is only possible
+ * if the chunk is the first in its block and everything after it is free, and
+ * not while any mark is active (marks find their blocks by their place in the
+ * block list), nor for a pinned block, which the pool has to keep. Returns
+ * FALSE, having done nothing, if it is not possible. */
+static BOOL
+wof_promote_to_jumbo(wof_allocator_t *allocator,
+                     wof_chunk_hdr_t *chunk)
+{
+    wof_block_hdr_t *block;
+    wof_chunk_hdr_t *next;
+
+    if (chunk->prev != 0 || allocator->marks) {
+        return FALSE;
+    }
+
+    next = WOF_CHUNK_NEXT(chunk);
+    if (next && (next->used || !next->last)) {
+        return FALSE;
+    }
+
+    block = WOF_CHUNK_TO_BLOCK(chunk);
+
+    if (block->pinned) {
+        return FALSE;
+    }
+
+    if (next && WOF_CHUNK_DATA_LEN(next) >= WOF_FREE_HEADER_SIZE) {
+        wof_unlink_free_chunk(allocator, next);
+    }
+
+    wof_remove_from_block_list(&allocator->block_list, block);
+    allocator->stats.blocks--;
+    allocator->stats.block_bytes -= block->size;
+    allocator->stats.bytes_in_use -= chunk->len;
+    allocator->cur_blocks--;
+    allocator->used_chunks--;
+
+    block->epoch = allocator->marks_taken;
+    wof_add_to_block_list(&allocator->jumbo_list, block);
+    allocator->stats.jumbo_blocks++;
+    allocator->stats.jumbo_bytes += block->size;
+
+    chunk->last  = TRUE;
+    chunk->jumbo = TRUE;
+    chunk->len   = 0;
+
+    return TRUE;
+}
+
+/* Undoes wof_promote_to_jumbo, for when the promoted block could not then be
+ * grown. The chunk's length and last flag are the ones it had beforehand;
+ * the free chunk after it, if any, is still intact in the block. */
+static void
+wof_demote_from_jumbo(wof_allocator_t *allocator,
+                      wof_chunk_hdr_t *chunk,
+                      const size_t len, const BOOL last)
+{
+    wof_block_hdr_t *block;
+
+    block = WOF_CHUNK_TO_BLOCK(chunk);
+
+    wof_remove_from_block_list(&allocator->jumbo_list, block);
+    allocator->stats.jumbo_blocks--;
+    allocator->stats.jumbo_bytes -= block->size;
+
+    block->epoch = allocator->epoch;
+    wof_add_to_block_list(&allocator->block_list, block);
+    allocator->stats.blocks++;
+    allocator->stats.block_bytes += block->size;
+    allocator->stats.bytes_in_use += len;
+    allocator->cur_blocks++;
+    allocator->used_chunks++;
+
+    chunk->last  = last;
+    chunk->jumbo = FALSE;
+    chunk->len   = len;
+
+    if (! last) {
+        wof_add_to_recycler(allocator, WOF_CHUNK_NEXT(chunk));
+    }
+}
+
+/* Frees special 'jumbo' blocks of sizes that won't fit normally. */
+static void
+wof_free_jumbo_block(wof_allocator_t *allocator,
+                     wof_block_hdr_t *block)
+{
+    wof_remove_from_block_list(&allocator->jumbo_list, block);
+    allocator->stats.jumbo_blocks--;
+    allocator->stats.jumbo_bytes -= block->size;
+
+    wof_source_release(allocator, block);
+}
+
+static void
+wof_free_jumbo(wof_allocator_t *allocator,
+               wof_chunk_hdr_t *chunk)
+{
+    wof_free_jumbo_block(allocator, WOF_JUMBO_TO_BLOCK(chunk));
+}
+
+/* Reallocs special 'jumbo' blocks of sizes that won't fit normally. The
+ * chunk keeps its offset within the block, but if the block moves then the
+ * data is only guaranteed the default alignment. */
+static void *
+wof_realloc_jumbo(wof_allocator_t *allocator,
+                  wof_chunk_hdr_t *chunk,
+                  const size_t size)
+{
+    wof_block_hdr_t *block;
+    unsigned char   *data;
+    size_t           offset;
+
+    offset = chunk->prev;
+    block  = WOF_JUMBO_TO_BLOCK(chunk);
+    allocator->stats.jumbo_bytes -= block->size;
+
+    block = wof_source_resize(allocator, block, size
+            + WOF_BLOCK_HEADER_SIZE
+            + WOF_CHUNK_HEADER_SIZE
+            + offset);
+
+    if (block == NULL) {
+        allocator->stats.jumbo_bytes += WOF_JUMBO_TO_BLOCK(chunk)->size;
+        return NULL;
+    }
+
+    allocator->stats.jumbo_bytes += block->size;
+
+    if (block->next) {
+        block->next->prev = block;
+    }
+
+    if (block->prev) {
+        block->prev->next = block;
+    }
+    else {
+        allocator->jumbo_list = block;
+    }
+
+    data = (unsigned char *)WOF_CHUNK_TO_DATA(WOF_BLOCK_TO_CHUNK(block))
+        + offset;
+
+    if (data != (unsigned char *)WOF_CHUNK_TO_DATA(chunk)) {
+        WOF_PROBE4(realloc_move, allocator, WOF_CHUNK_TO_DATA(chunk), data,
+                size);
+
+        /* moved under a mark, so it belongs to the newest mark now, like
+         * anything else a realloc moves: stamp it afresh and bring it to the
+         * front, where wof_release_to_mark looks */
+        if (allocator->marks) {
+            wof_remove_from_block_list(&allocator->jumbo_list, block);
+            block->epoch = allocator->marks_taken;
+            wof_add_to_block_list(&allocator->jumbo_list, block);
+        }
+    }
+
+    return data;
+}
+
+/* ALIGNED ALLOCATIONS */
+
+/* Returns the number of bytes that must be split off the front of the given
+ * free chunk so that the data of the chunk that follows is aligned to
+ * `alignment`. The slack is either zero or large enough to hold a chunk header
+ * of its own, so that it can be kept as a (possibly tiny) free chunk. */
+static size_t
+wof_align_slack(wof_chunk_hdr_t *chunk, const size_t alignment)
+{
+    size_t data, slack;
+
+    data  = (size_t)WOF_CHUNK_TO_DATA(chunk);
+    slack = (alignment - (data & (alignment - 1))) & (alignment - 1);
+
+    while (slack && slack < WOF_CHUNK_HEADER_SIZE) {
+        slack += alignment;
+    }
+
+    return slack;
+}
+
+/* Returns TRUE if the free chunk can hold `size` bytes of data at an address
+ * aligned to `alignment`, once any leading slack has been split off. */
+static BOOL
+wof_chunk_fits_aligned(wof_chunk_hdr_t *chunk,
+                       const size_t size,
+                       const size_t alignment)
+{
+    size_t needed;
+
+    needed = WOF_ALIGN_SIZE(size);
+    if (needed < WOF_FREE_HEADER_SIZE) {
+        needed = WOF_FREE_HEADER_SIZE;
+    }
+
+    return WOF_CHUNK_DATA_LEN(chunk) >=
+        wof_align_slack(chunk, alignment) + needed;
+}
+
+/* Allocates a chunk whose data is aligned to `alignment` (a power of two that
+ * is a multiple of WOF_ALIGN_AMOUNT). Chunks are found the same way as in
+ * wof_alloc, except that the fit takes the alignment slack into account. Any
+ * slack is split off the front of the chunk and put back in the recycler. The
+ * caller must ensure that `size + alignment` fits in a block. */
+static void *
+wof_alloc_aligned_chunk(wof_allocator_t *allocator,
+                        const size_t size,
+                        const size_t alignment)
+{
+    wof_chunk_hdr_t *chunk;
+    size_t slack;
+
+    chunk = NULL;
+
+    if (allocator->marks) {
+        /* everything comes off the master while a mark is active */
+    }
+    else if (allocator->tlsf) {
+        /* ask for enough that the worst-case slack still leaves room */
+        chunk = wof_tlsf_find(allocator->tlsf, WOF_CHUNK_HEADER_SIZE
+                + alignment + WOF_CHUNK_HEADER_SIZE
+                + WOF_ALIGN_SIZE(size) + WOF_FREE_HEADER_SIZE);
+    }
+    else if (allocator->recycler_head &&
+            wof_chunk_fits_aligned(allocator->recycler_head, size, alignment)) {
+        chunk = allocator->recycler_head;
+    }
+
+    if (chunk == NULL) {
+        if (allocator->master_head &&
+                !wof_chunk_fits_aligned(allocator->master_head, size,
+                    alignment)) {
+            chunk = allocator->master_head;
+            wof_pop_master(allocator);
+            wof_add_to_recycler(allocator, chunk);
+        }
+
+        if (!allocator->master_head) {
+            wof_new_block(allocator);
+        }
+
+        chunk = allocator->master_head;
+    }
+
+    if (!chunk || !wof_chunk_fits_aligned(chunk, size, alignment)) {
+        return NULL;
+    }
+
+    slack = wof_align_slack(chunk, alignment);
+
+    if (slack) {
+        /* Split the slack off the front. The leading piece is taken out of
+         * whichever list the chunk was in and the rest of the chunk takes its
+         * place, so the leading piece has to go back in the recycler. */
+        wof_split_free_chunk(allocator, chunk, slack - WOF_CHUNK_HEADER_SIZE);
+        wof_add_to_recycler(allocator, chunk);
+        chunk = WOF_CHUNK_NEXT(chunk);
+    }
+
+    wof_split_free_chunk(allocator, chunk, size);
+
+    wof_cycle_recycler(allocator);
+
+    chunk->used = TRUE;
+    allocator->used_chunks++;
+    allocator->stats.bytes_in_use += chunk->len;
+
+    return WOF_CHUNK_TO_DATA(chunk);
+}
+
+/* NOFREE ALLOCATIONS */
+
+/* Objects from wof_alloc_nofree live in 'arena' chunks: ordinary used chunks
+ * carved off the tail end of a master chunk, holding any number of objects
+ * back to back with no headers of their own. The master chunk is eaten from
+ * the front by ordinary allocations and from the back by its arena, which
+ * grows to the left: each new object is carved off the master chunk's tail,
+ * and the arena's header is slid down over it so that the object becomes the
+ * first thing in the arena's data. Nothing else ever puts a chunk directly
+ * after a master chunk, so the pool only needs to remember the arena it is
+ * working on and check that it still follows the master head. */
+
+/* Carves `size` (aligned) bytes off the tail of the master head for a nofree
+ * object, starting a new arena if the current one does not follow it. The
+ * caller has made sure the master head is big enough. */
+static void *
+wof_carve_nofree(wof_allocator_t *allocator, const size_t size)
+{
+    wof_chunk_hdr_t *master, *arena, *next;
+    wof_chunk_hdr_t  hdr;
+
+    master = allocator->master_head;
+    arena  = allocator->nofree_arena;
+
+    if (arena && !master->last && WOF_CHUNK_NEXT(master) == arena) {
+        /* slide the arena's header down over the new object */
+        hdr = *arena;
+        master->len -= (int)size;
+        arena = WOF_CHUNK_NEXT(master);
+        *arena = hdr;
+        arena->len += (int)size;
+        WOF_CHUNK_SET_BLOCK(arena, hdr.block - (int)size);
+    }
+    else {
+        /* start a new arena at the end of the master chunk */
+        master->len -= (int)(size + WOF_CHUNK_HEADER_SIZE);
+        arena = (wof_chunk_hdr_t *)((unsigned char *)master + master->len);
+        arena->len   = (int)(size + WOF_CHUNK_HEADER_SIZE);
+        arena->last  = master->last;
+        arena->used  = TRUE;
+        arena->jumbo = FALSE;
+        WOF_CHUNK_SET_BLOCK(arena, master->block + master->len);
+        master->last = FALSE;
+        allocator->used_chunks++;
+        allocator->stats.bytes_in_use += WOF_CHUNK_HEADER_SIZE;
+    }
+
+    arena->prev = master->len;
+    if (!arena->last) {
+        next = WOF_CHUNK_NEXT(arena);
+        next->prev = arena->len;
+    }
+
+    allocator->nofree_arena = arena;
+    allocator->stats.bytes_in_use += size;
+
+    return WOF_CHUNK_TO_DATA(arena);
+}
+
+/* SMALL OBJECTS */
+
+/* Returns the header of the slab that `ptr` points into, or NULL if it is not
+ * a small object. Every chunk in a small-object pool is at least a slab's
+ * length into its block's memory, or else after a slab boundary within it, so
+ * the boundary below any pointer the pool handed out can always be read. What
+ * is there decides nothing until the table confirms it. */
+static wof_slab_hdr_t *
+wof_small_slab(const wof_small_t *small, const void *ptr)
+{
+    wof_slab_hdr_t *slab;
+
+    slab = WOF_PTR_TO_SLAB(ptr);
+
+    if (slab->index < small->n_slabs && small->slabs[slab->index] == slab) {
+        return slab;
+    }
+
+    return NULL;
+}
+
+/* Forgets about every slab and every free object. The slabs themselves are
+ * ordinary chunks, so they are reclaimed along with everything else; their
+ * headers are left as they are, but the table no longer points at them. */
+static void
+wof_small_reset(wof_small_t *small)
+{
+    size_t i;
+
+    for (i = 0; i < WOF_SMALL_CLASSES; i++) {
+        small->classes[i].free_list = NULL;
+        small->classes[i].bump      = NULL;
+        small->classes[i].end       = NULL;
+    }
+
+    small->n_slabs = 0;
+}
+
+/* Makes room in the table for one more slab. Returns FALSE if it is full and
+ * could not be grown. */
+static BOOL
+wof_small_reserve_slab(wof_small_t *small)
+{
+    wof_slab_hdr_t **slabs;
+    size_t           max;
+
+    if (small->n_slabs < small->max_slabs) {
+        return TRUE;
+    }
+
+    max   = small->max_slabs ? small->max_slabs * 2 : 64;
+    slabs = (wof_slab_hdr_t **)realloc(small->slabs,
+            max * sizeof(wof_slab_hdr_t *));
+    if (slabs == NULL) {
+        return FALSE;
+    }
+
+    small->slabs     = slabs;
+    small->max_slabs = max;
+
+    return TRUE;
+}
+
+/* Serves a small request from its size class. Returns NULL if a new slab was
+ * needed and could not be set up, in which case the caller falls back to the
+ * ordinary chunk logic. */
+static void *
+wof_small_alloc(wof_allocator_t *allocator, const size_t size)
+{
+    wof_small_class_t *cls;
+    wof_slab_hdr_t    *slab;
+    size_t             idx, obj_size;
+    void              *obj;
+
+    idx      = WOF_SMALL_CLASS(size);
+    cls      = &allocator->small->classes[idx];
+    obj_size = WOF_SMALL_OBJ_SIZE(idx);
+
+    if (cls->free_list) {
+        /* Reuse a freed object if we have one. */
+        obj = cls->free_list;
+        cls->free_list = *(void **)obj;
+        return obj;
+    }
+
+    if (cls->bump == NULL || (size_t)(cls->end - cls->bump) < obj_size) {
+        /* The current slab (if any) is used up, so start a new one. Its chunk
+         * header takes the end of the unit before, so the chunk is a whole
+         * unit long and the next slab can start right after it. */
+        if (!wof_small_reserve_slab(allocator->small)) {
+            return NULL;
+        }
+
+        slab = (wof_slab_hdr_t *)wof_alloc_aligned_chunk(allocator,
+                WOF_SLAB_SIZE - WOF_CHUNK_HEADER_SIZE, WOF_SLAB_SIZE);
+
+        if (slab == NULL) {
+            return NULL;
+        }
+
+        slab->index = allocator->small->n_slabs;
+        slab->cls   = idx;
+        allocator->small->slabs[allocator->small->n_slabs++] = slab;
+
+        cls->bump = (unsigned char *)slab + WOF_SLAB_HEADER_SIZE;
+        cls->end  = (unsigned char *)slab + WOF_SLAB_SIZE
+            - WOF_CHUNK_HEADER_SIZE;
+    }
+
+    obj = cls->bump;
+    cls->bump += obj_size;
+
+    return obj;
+}
+
+/* Returns a small object to the free list of its size class. */
+static void
+wof_small_free(wof_allocator_t *allocator,
+               wof_slab_hdr_t *slab,
+               void *ptr)
+{
+    wof_small_class_t *cls;
+
+    cls = &allocator->small->classes[slab->cls];
+
+    *(void **)ptr  = cls->free_list;
+    cls->free_list = ptr;
+}
+
+/* Reallocs a small object. It stays put if it still fits in its size class,
+ * otherwise it is moved to wherever wof_alloc puts the new size. */
+static void *
+wof_small_realloc(wof_allocator_t *allocator,
+                  wof_slab_hdr_t *slab,
+                  void *ptr,
+                  const size_t size)
+{
+    size_t obj_size;
+    void  *newptr;
+
+    obj_size = WOF_SMALL_OBJ_SIZE(slab->cls);
+
+    if (size <= obj_size) {
+        return ptr;
+    }
+
+    newptr = wof_alloc(allocator, size);
+    if (newptr == NULL) {
+        return NULL;
+    }
+    memcpy(newptr, ptr, obj_size);
+    WOF_PROBE4(realloc_move, allocator, ptr, newptr, size);
+
+    wof_small_free(allocator, slab, ptr);
+
+    return newptr;
+}
+
+/* FREEING */
+
+/* The guts of wof_free, for a chunk that we know belongs to this allocator. */
+static void
+wof_free_chunk(wof_allocator_t *allocator, wof_chunk_hdr_t *chunk)
+{
+    if (chunk->jumbo) {
+        wof_free_jumbo(allocator, chunk);
+        return;
+    }
+
+    /* mark it as unused */
+    chunk->used = FALSE;
+    allocator->used_chunks--;
+    allocator->stats.bytes_in_use -= chunk->len;
+
+    /* merge it with any other free chunks adjacent to it, so that contiguous
+     * free space doesn't get fragmented */
+    wof_merge_free(allocator, chunk);
+
+    /* Now cycle the recycler */
+    wof_cycle_recycler(allocator);
+}
+
+/* REMOTE FREES */
+
+#ifdef WOF_THREADS
+
+/* Called by a thread that does not own the chunk's block: pushes the chunk
+ * onto the block's remote list. If the list was empty, the block also has to
+ * be pushed onto its owner's list of blocks with pending remote frees. The
+ * owner only ever takes each list as a whole, so a plain CAS push is safe. */
+static void
+wof_remote_free(wof_block_hdr_t *block, wof_chunk_hdr_t *chunk)
+{
+    wof_allocator_t *owner;
+    wof_chunk_hdr_t *head;
+    wof_block_hdr_t *block_head;
+
+    head = WOF_ATOMIC_LOAD(&block->remote);
+    do {
+        WOF_GET_FREE(chunk)->next = head;
+    } while (!WOF_ATOMIC_CAS(&block->remote, &head, chunk));
+
+    if (head != NULL) {
+        /* the owner already knows about this block */
+        return;
+    }
+
+    owner = block->owner;
+    block_head = WOF_ATOMIC_LOAD(&owner->remote_blocks);
+    do {
+        block->remote_next = block_head;
+    } while (!WOF_ATOMIC_CAS(&owner->remote_blocks, &block_head, block));
+}
+
+/* Takes back every chunk that other threads have freed since the last time
+ * we looked, and frees them for real. If `discard` is set the chunks are
+ * simply forgotten instead (which is what free_all wants). */
+static void
+wof_drain_remote(wof_allocator_t *allocator, const BOOL discard)
+{
+    wof_block_hdr_t *block, *next_block;
+    wof_chunk_hdr_t *chunk, *next_chunk;
+
+    block = WOF_ATOMIC_EXCHANGE(&allocator->remote_blocks,
+            (wof_block_hdr_t *)NULL);
+
+    while (block) {
+        /* Read the link before emptying the block's list: as soon as it is
+         * empty, another thread may push the block onto our list again. */
+        next_block = block->remote_next;
+        chunk = WOF_ATOMIC_EXCHANGE(&block->remote, (wof_chunk_hdr_t *)NULL);
+
+        while (chunk && !discard) {
+            next_chunk = WOF_GET_FREE(chunk)->next;
+            wof_free_chunk(allocator, chunk);
+            chunk = next_chunk;
+        }
+
+        block = next_block;
+    }
+}
+
+#endif /* WOF_THREADS */
+
+/* MARKS */
+
+/* Takes every chunk from `chunk` up to `end` (or to the end of the block, if
+ * `end` is NULL) out of the pool's books: free chunks are unlinked from their
+ * lists, and used ones are forgotten. Returns the 'last' flag of the final
+ * chunk, so the caller can lay a single free chunk over the lot. */
+static BOOL
+wof_release_chunks(wof_allocator_t *allocator,
+                   wof_chunk_hdr_t *chunk,
+                   const unsigned char *end)
+{
+    BOOL last;
+
+    do {
+        if (chunk->used) {
+            allocator->used_chunks--;
+            allocator->stats.bytes_in_use -= chunk->len;
+        }
+        else if (WOF_CHUNK_DATA_LEN(chunk) >= WOF_FREE_HEADER_SIZE) {
+            wof_unlink_free_chunk(allocator, chunk);
+        }
+
+        last  = chunk->last;
+        chunk = (wof_chunk_hdr_t *)((unsigned char *)chunk + chunk->len);
+    } while (!last && (unsigned char *)chunk != end);
+
+    return last;
+}
+
+/* TRACING */
+
+#ifdef WOF_TRACE
+
+#define WOF_TRACE_HASH(PTR, MASK) \
+        ((((size_t)(PTR) / WOF_ALIGN_AMOUNT) * 2654435761UL) & (MASK))
+
+static void
+wof_trace_varint(FILE *out, size_t value)
+{
+    while (value >= 0x80) {
+        putc((int)(value & 0x7F) | 0x80, out);
+        value >>= 7;
+    }
+    putc((int)value, out);
+}
+
+/* Inserts a pointer into the map, without checking the load factor. */
+static void
+wof_trace_insert(wof_trace_t *trace, const void *ptr,
+                 const unsigned long id, const unsigned long born)
+{
+    size_t i, mask;
+
+    mask = trace->capacity - 1;
+
+    for (i = WOF_TRACE_HASH(ptr, mask);
+            trace->map[i].ptr;
+            i = (i + 1) & mask) {
+        /* linear probing */
+    }
+
+    trace->map[i].ptr  = ptr;
+    trace->map[i].id   = id;
+    trace->map[i].born = born;
+    trace->count++;
+}
+
+/* Records the ID of a new object, growing the map if it is more than half
+ * full. If the map cannot be grown the object is simply not remembered, and
+ * will be traced as unknown when it is freed. */
+static void
+wof_trace_remember(wof_trace_t *trace, const void *ptr,
+                   const unsigned long id, const unsigned long born)
+{
+    wof_trace_entry_t *old_map;
+    size_t             old_capacity, i;
+
+    if ((trace->count + 1) * 2 > trace->capacity) {
+        old_map      = trace->map;
+        old_capacity = trace->capacity;
+
+        trace->capacity = old_capacity ? old_capacity * 2 : 1024;
+        trace->map = (wof_trace_entry_t *)calloc(trace->capacity,
+                sizeof(wof_trace_entry_t));
+
+        if (trace->map == NULL) {
+            trace->map      = old_map;
+            trace->capacity = old_capacity;
+            return;
+        }
+
+        trace->count = 0;
+        for (i = 0; i < old_capacity; i++) {
+            if (old_map[i].ptr) {
+                wof_trace_insert(trace, old_map[i].ptr, old_map[i].id,
+                        old_map[i].born);
+            }
+        }
+
+        free(old_map);
+    }
+
+    wof_trace_insert(trace, ptr, id, born);
+}
+
+/* Removes a pointer from the map and returns its ID (and, if `born` is not
+ * NULL, its birth), or 0 if it is not in the map. The entries after it in its
+ * run are shifted back to close the gap, so the map never needs tombstones. */
+static unsigned long
+wof_trace_forget(wof_trace_t *trace, const void *ptr, unsigned long *born)
+{
+    unsigned long id;
+    size_t        i, j, home, mask;
+
+    if (ptr == NULL || trace->count == 0) {
+        return 0;
+    }
+
+    mask = trace->capacity - 1;
+
+    for (i = WOF_TRACE_HASH(ptr, mask);
+            trace->map[i].ptr != ptr;
+            i = (i + 1) & mask) {
+        if (trace->map[i].ptr == NULL) {
+            return 0;
+        }
+    }
+
+    id = trace->map[i].id;
+    if (born) {
+        *born = trace->map[i].born;
+    }
+    trace->count--;
+
+    for (j = (i + 1) & mask; trace->map[j].ptr; j = (j + 1) & mask) {
+        home = WOF_TRACE_HASH(trace->map[j].ptr, mask);
+
+        /* the entry at j can move into the gap at i unless its home slot
+         * lies cyclically in (i, j] */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            trace->map[i] = trace->map[j];
+            i = j;
+        }
+    }
+    trace->map[i].ptr = NULL;
+
+    return id;
+}
+
+/* Writes a reference to an object (see the format notes in the header). */
+static void
+wof_trace_object(wof_trace_t *trace, const unsigned long id)
+{
+    wof_trace_varint(trace->out, id ? trace->next_id - id : 0);
+}
+
+/* Hands out the next ID to the result of an alloc or realloc. `born` is the
+ * birth of the memory if it was already ours, or 0 if it is new. */
+static void
+wof_trace_result(wof_trace_t *trace, const void *ptr, const unsigned long born)
+{
+    if (ptr) {
+        wof_trace_remember(trace, ptr, trace->next_id,
+                born ? born : trace->next_id);
+    }
+    trace->next_id++;
+}
+
+static void *
+wof_traced_alloc(wof_allocator_t *allocator, const size_t size)
+{
+    wof_trace_t *trace = allocator->trace;
+    void        *ptr;
+
+    trace->busy = TRUE;
+    ptr = wof_alloc(allocator, size);
+    trace->busy = FALSE;
+
+    putc(WOF_TRACE_ALLOC, trace->out);
+    wof_trace_varint(trace->out, size);
+    wof_trace_result(trace, ptr, 0);
+
+    return ptr;
+}
+
+static void *
+wof_traced_alloc_aligned(wof_allocator_t *allocator,
+                         const size_t size,
+                         const size_t alignment)
+{
+    wof_trace_t *trace = allocator->trace;
+    void        *ptr;
+
+    trace->busy = TRUE;
+    ptr = wof_alloc_aligned(allocator, size, alignment);
+    trace->busy = FALSE;
+
+    putc(WOF_TRACE_ALLOC_ALIGNED, trace->out);
+    wof_trace_varint(trace->out, size);
+    wof_trace_varint(trace->out, alignment);
+    wof_trace_result(trace, ptr, 0);
+
+    return ptr;
+}
+
+static void *
+wof_traced_alloc_nofree(wof_allocator_t *allocator, const size_t size)
+{
+    wof_trace_t *trace = allocator->trace;
+    void        *ptr;
+
+    trace->busy = TRUE;
+    ptr = wof_alloc_nofree(allocator, size);
+    trace->busy = FALSE;
+
+    putc(WOF_TRACE_ALLOC_NOFREE, trace->out);
+    wof_trace_varint(trace->out, size);
+
+    /* the object can never be freed, so it needs an ID but not a place in
+     * the map */
+    trace->next_id++;
+
+    return ptr;
+}
+
+static void
+wof_traced_free(wof_allocator_t *allocator, void *ptr)
+{
+    wof_trace_t   *trace = allocator->trace;
+    unsigned long  id;
+
+    trace->busy = TRUE;
+    wof_free(allocator, ptr);
+    trace->busy = FALSE;
+
+    /* freeing NULL or an object the trace doesn't know about can't be
+     * replayed, so isn't recorded */
+    id = wof_trace_forget(trace, ptr, NULL);
+    if (id) {
+        putc(WOF_TRACE_FREE, trace->out);
+        wof_trace_object(trace, id);
+    }
+}
+
+static void *
+wof_traced_realloc(wof_allocator_t *allocator, void *ptr, const size_t size)
+{
+    wof_trace_t   *trace = allocator->trace;
+    unsigned long  id, born = 0;
+    void          *newptr;
+
+    trace->busy = TRUE;
+    newptr = wof_realloc(allocator, ptr, size);
+    trace->busy = FALSE;
+
+    putc(WOF_TRACE_REALLOC, trace->out);
+
+    if (newptr == NULL && size != 0) {
+        /* it failed, so the old object is still alive */
+        id = 0;
+        if (ptr) {
+            id = wof_trace_forget(trace, ptr, &born);
+            if (id) {
+                wof_trace_remember(trace, ptr, id, born);
+            }
+        }
+    }
+    else {
+        id = wof_trace_forget(trace, ptr, &born);
+    }
+
+    wof_trace_object(trace, id);
+    wof_trace_varint(trace->out, size);
+    wof_trace_result(trace, newptr, newptr == ptr && id ? born : 0);
+
+    return newptr;
+}
+
+/* Only a success is recorded (as a REALLOC, which replays in place too); a
+ * failure changes nothing. */
+static void *
+wof_traced_realloc_try_in_place(wof_allocator_t *allocator, void *ptr,
+                                const size_t size)
+{
+    wof_trace_t   *trace = allocator->trace;
+    unsigned long  id, born = 0;
+    void          *newptr;
+
+    trace->busy = TRUE;
+    newptr = wof_realloc_try_in_place(allocator, ptr, size);
+    trace->busy = FALSE;
+
+    if (newptr == NULL) {
+        return NULL;
+    }
+
+    putc(WOF_TRACE_REALLOC, trace->out);
+
+    id = wof_trace_forget(trace, ptr, &born);
+
+    wof_trace_object(trace, id);
+    wof_trace_varint(trace->out, size);
+    wof_trace_result(trace, newptr, id ? born : 0);
+
+    return newptr;
+}
+
+/* Records a release of `count` marks. Every object the trace knows about whose
+ * memory was allocated since the last of them was taken dies. */
+static void
+wof_trace_release(wof_trace_t *trace,
+                  const unsigned long first_id,
+                  const unsigned long count)
+{
+    size_t i;
+
+    putc(WOF_TRACE_RELEASE, trace->out);
+    wof_trace_varint(trace->out, count);
+
+    for (i = 0; i < trace->capacity; i++) {
+        /* forgetting an entry can shift a later one back into this slot, so
+         * keep looking at it until it holds a survivor */
+        while (trace->map[i].ptr && trace->map[i].born >= first_id) {
+            wof_trace_forget(trace, trace->map[i].ptr, NULL);
+        }
+    }
+}
+
+/* Records one of the calls that take no operands. A free_all also kills every
+ * object the trace knows about. */
+static void
+wof_trace_op(wof_trace_t *trace, const int op)
+{
+    putc(op, trace->out);
+
+    if (op == WOF_TRACE_FREE_ALL && trace->count) {
+        memset(trace->map, 0, trace->capacity * sizeof(wof_trace_entry_t));
+        trace->count = 0;
+    }
+}
+
+#endif /* WOF_TRACE */
+
+/* API */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+void *
+wof_alloc(wof_allocator_t *allocator, const size_t size)
+{
+    wof_chunk_hdr_t *chunk;
+    void            *ptr;
+
+#ifdef WOF_TRACE
+    if (WOF_TRACING(allocator)) {
+        return wof_traced_alloc(allocator, size);
+    }
+#endif /* WOF_TRACE */
+
+#ifdef WOF_THREADS
+    if (WOF_ATOMIC_LOAD(&allocator->remote_blocks)) {
+        wof_drain_remote(allocator, FALSE);
+    }
+#endif /* WOF_THREADS */
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    allocator->stats.bytes_requested += size;
+
+    if (size > WOF_BLOCK_MAX_ALLOC_SIZE(allocator)) {
+        ptr = wof_alloc_jumbo(allocator, size, WOF_ALIGN_AMOUNT);
+        WOF_PROBE3(alloc, allocator, ptr, size);
+        return ptr;
+    }
+    else if (allocator->small && size <= WOF_SMALL_MAX_SIZE &&
+            !allocator->marks) {
+        ptr = wof_small_alloc(allocator, size);
+        if (ptr) {
+            WOF_PROBE3(alloc, allocator, ptr, size);
+            return ptr;
+        }
+        /* otherwise fall through and serve it as an ordinary chunk */
+    }
+
+    chunk = NULL;
+
+    if (allocator->marks) {
+        /* While a mark is active, everything is carved from the master so
+         * that wof_release_to_mark can find it again. */
+    }
+    else if (allocator->tlsf) {
+        /* If the index has a chunk that fits, use that. */
+        chunk = wof_tlsf_find(allocator->tlsf,
+                WOF_ALIGN_SIZE(size) + WOF_CHUNK_HEADER_SIZE);
+    }
+    else if (allocator->recycler_head &&
+            WOF_CHUNK_DATA_LEN(allocator->recycler_head) >= size) {
+
+        /* If we can serve it from the recycler, do so. */
+        chunk = allocator->recycler_head;
+    }
+
+    if (chunk) {
+        allocator->stats.recycler_hits++;
+    }
+    else {
+        if (allocator->master_head &&
+                WOF_CHUNK_DATA_LEN(allocator->master_head) < size) {
+
+            /* Recycle the head of the master list if necessary. */
+            chunk = allocator->master_head;
+            wof_pop_master(allocator);
+            wof_add_to_recycler(allocator, chunk);
+        }
+
+        if (!allocator->master_head) {
+            /* Allocate a new block if necessary. */
+            wof_new_block(allocator);
+            allocator->stats.new_block_hits++;
+        }
+        else {
+            allocator->stats.master_hits++;
+        }
+
+        chunk = allocator->master_head;
+    }
+
+    if (!chunk) {
+        /* We don't have enough, and the OS wouldn't give us more. */
+        WOF_PROBE3(alloc, allocator, NULL, size);
+        return NULL;
+    }
+
+    /* Split our chunk into two to preserve any trailing free space */
+    wof_split_free_chunk(allocator, chunk, size);
+
+    /* Now cycle the recycler */
+    wof_cycle_recycler(allocator);
+
+    /* mark it as used */
+    chunk->used = TRUE;
+    allocator->used_chunks++;
+    allocator->stats.bytes_in_use += chunk->len;
+
+    WOF_PROBE3(alloc, allocator, WOF_CHUNK_TO_DATA(chunk), size);
+
+    /* and return the user's pointer */
+    return WOF_CHUNK_TO_DATA(chunk);
+}
+
+void *
+wof_alloc_aligned(wof_allocator_t *allocator,
+                  const size_t size,
+                  const size_t alignment)
+{
+#ifdef WOF_TRACE
+    if (WOF_TRACING(allocator)) {
+        return wof_traced_alloc_aligned(allocator, size, alignment);
+    }
+#endif /* WOF_TRACE */
+
+    if (alignment <= WOF_ALIGN_AMOUNT) {
+        /* everything is at least this aligned anyway */
+        return wof_alloc(allocator, size);
+    }
+
+    if (size == 0 || (alignment & (alignment - 1)) != 0 ||
+            alignment > WOF_MAX_BLOCK_SIZE) {
+        return NULL;
+    }
+
+#ifdef WOF_THREADS
+    if (WOF_ATOMIC_LOAD(&allocator->remote_blocks)) {
+        wof_drain_remote(allocator, FALSE);
+    }
+#endif /* WOF_THREADS */
+
+    allocator->stats.bytes_requested += size;
+
+    /* The leading slack can be up to a little more than the alignment, so
+     * leave room for two lots of it when deciding if a block will do. The
+     * result is never a small object, since those are only aligned to their
+     * size class. */
+    if (WOF_ALIGN_SIZE(size) + 2 * alignment >
+            WOF_BLOCK_MAX_ALLOC_SIZE(allocator)) {
+        return wof_alloc_jumbo(allocator, size, alignment);
+    }
+
+    return wof_alloc_aligned_chunk(allocator, size, alignment);
+}
+
+void *
+wof_alloc_nofree(wof_allocator_t *allocator, const size_t size)
+{
+    wof_chunk_hdr_t *chunk;
+    size_t           needed;
+
+#ifdef WOF_TRACE
+    if (WOF_TRACING(allocator)) {
+        return wof_traced_alloc_nofree(allocator, size);
+    }
+#endif /* WOF_TRACE */
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    /* Room for the object, for a new arena's header in case we need one, and
+     * for the master chunk to keep its own free header. */
+    needed = WOF_ALIGN_SIZE(size) + WOF_CHUNK_HEADER_SIZE
+        + WOF_FREE_HEADER_SIZE;
+
+    if (needed > WOF_BLOCK_MAX_ALLOC_SIZE(allocator)) {
+        /* it would never fit in a block, so it has to be a jumbo chunk, and
+         * might as well be an ordinary one */
+        return wof_alloc(allocator, size);
+    }
+
+    allocator->stats.bytes_requested += size;
+
+    if (allocator->master_head &&
+            WOF_CHUNK_DATA_LEN(allocator->master_head) < needed) {
+        /* The master head is nearly used up, so retire it to the recycler
+         * just as wof_alloc would. */
+        chunk = allocator->master_head;
+        wof_pop_master(allocator);
+        wof_add_to_recycler(allocator, chunk);
+    }
+
+    if (!allocator->master_head) {
+        wof_new_block(allocator);
+
+        if (!allocator->master_head) {
+            return NULL;
+        }
+    }
+
+    return wof_carve_nofree(allocator, WOF_ALIGN_SIZE(size));
+}
+
+void
+wof_free(wof_allocator_t *allocator, void *ptr)
+{
+    wof_chunk_hdr_t *chunk;
+    wof_slab_hdr_t  *slab;
+
+#ifdef WOF_TRACE
+    if (WOF_TRACING(allocator)) {
+        wof_traced_free(allocator, ptr);
+        return;
+    }
+#endif /* WOF_TRACE */
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    WOF_PROBE2(free, allocator, ptr);
+
+    if (allocator->small &&
+            (slab = wof_small_slab(allocator->small, ptr)) != NULL) {
+        wof_small_free(allocator, slab, ptr);
+        return;
+    }
+
+    chunk = WOF_DATA_TO_CHUNK(ptr);
+
+#ifdef WOF_THREADS
+    if (WOF_CHUNK_OWNING_BLOCK(chunk)->owner != allocator) {
+        /* someone else's chunk, so leave it for them to deal with */
+        wof_remote_free(WOF_CHUNK_OWNING_BLOCK(chunk), chunk);
+        return;
+    }
+#endif /* WOF_THREADS */
+
+    wof_free_chunk(allocator, chunk);
+}
+
+void *
+wof_realloc(wof_allocator_t *allocator, void *ptr, const size_t size)
+{
+    wof_chunk_hdr_t *chunk;
+    wof_slab_hdr_t  *slab;
+
+#ifdef WOF_TRACE
+    if (WOF_TRACING(allocator)) {
+        return wof_traced_realloc(allocator, ptr, size);
+    }
+#endif /* WOF_TRACE */
+
+    if (ptr == NULL) {
+        return wof_alloc(allocator, size);
+    }
+
+    if (size == 0) {
+        wof_free(allocator, ptr);
+        return NULL;
+    }
+
+    if (allocator->small &&
+            (slab = wof_small_slab(allocator->small, ptr)) != NULL) {
+        return wof_small_realloc(allocator, slab, ptr, size);
+    }
+
+    chunk = WOF_DATA_TO_CHUNK(ptr);
+
+#ifdef WOF_THREADS
+    if (WOF_CHUNK_OWNING_BLOCK(chunk)->owner != allocator) {
+        /* We can't touch someone else's chunks, so move the data into one of
+         * ours and hand the old chunk back to its owner. */
+        wof_block_hdr_t *block;
+        size_t           len;
+        void            *newptr;
+
+        block = WOF_CHUNK_OWNING_BLOCK(chunk);
+        len   = chunk->jumbo
+            ? block->size - WOF_BLOCK_HEADER_SIZE - WOF_CHUNK_HEADER_SIZE
+                - chunk->prev
+            : WOF_CHUNK_DATA_LEN(chunk);
+
+        newptr = wof_alloc(allocator, size);
+        if (newptr == NULL) {
+            return NULL;
+        }
+        memcpy(newptr, ptr, len < size ? len : size);
+        wof_remote_free(block, chunk);
+        WOF_PROBE4(realloc_move, allocator, ptr, newptr, size);
+
+        return newptr;
+    }
+#endif /* WOF_THREADS */
+
+    if (chunk->jumbo) {
+        return wof_realloc_jumbo(allocator, chunk, size);
+    }
+
+    if (size > WOF_CHUNK_DATA_LEN(chunk)) {
+        /* grow */
+        wof_chunk_hdr_t *tmp;
+        void            *newptr;
+        size_t           len;
+        BOOL             last;
+
+        len  = chunk->len;
+        last = chunk->last;
+
+        if (wof_grow_chunk(allocator, chunk, size)) {
+            /* the next chunk was free and had enough extra, so we just grabbed
+             * from that */
+            return ptr;
+        }
+        else if ((tmp = wof_absorb_neighbours(allocator, chunk, size))
+                != NULL) {
+            /* the previous chunk was free, so slide our data down into it
+             * and give back whatever is left over */
+            wof_split_used_chunk(allocator, tmp, size);
+            wof_cycle_recycler(allocator);
+            WOF_PROBE4(realloc_move, allocator, ptr, WOF_CHUNK_TO_DATA(tmp),
+                    size);
+            return WOF_CHUNK_TO_DATA(tmp);
+        }
+        else if (size > WOF_BLOCK_MAX_ALLOC_SIZE(allocator) &&
+                wof_promote_to_jumbo(allocator, chunk)) {
+            /* the chunk had its block to itself, so the block itself can be
+             * grown without copying anything first */
+            newptr = wof_realloc_jumbo(allocator, chunk, size);
+            if (newptr == NULL) {
+                /* the block is untouched, so make it ordinary again */
+                wof_demote_from_jumbo(allocator, chunk, len, last);
+                return NULL;
+            }
+            allocator->stats.bytes_requested += size;
+            return newptr;
+        }
+        else {
+            /* no room to grow, need to alloc, copy, free */
+            newptr = wof_alloc(allocator, size);
+            if (newptr == NULL) {
+                return NULL;
+            }
+            memcpy(newptr, ptr, WOF_CHUNK_DATA_LEN(chunk));
+            wof_free(allocator, ptr);
+            WOF_PROBE4(realloc_move, allocator, ptr, newptr, size);
+
+            /* No need to cycle the recycler, alloc and free both did that
+             * already */
+
+            return newptr;
+        }
+    }
+    else if (size < WOF_CHUNK_DATA_LEN(chunk)) {
+        /* shrink */
+        wof_split_used_chunk(allocator, chunk, size);
+
+        /* Now cycle the recycler */
+        wof_cycle_recycler(allocator);
+
+        return ptr;
+    }
+
+    /* no-op */
+    return ptr;
+}
+
+void *
+wof_realloc_try_in_place(wof_allocator_t *allocator, void *ptr,
+                         const size_t size)
+{
+    wof_chunk_hdr_t *chunk;
+    wof_block_hdr_t *block;
+    wof_slab_hdr_t  *slab;
+
+#ifdef WOF_TRACE
+    if (WOF_TRACING(allocator)) {
+        return wof_traced_realloc_try_in_place(allocator, ptr, size);
+    }
+#endif /* WOF_TRACE */
+
+    if (ptr == NULL || size == 0) {
+        return NULL;
+    }
+
+    if (allocator->small &&
+            (slab = wof_small_slab(allocator->small, ptr)) != NULL) {
+        return size <= WOF_SMALL_OBJ_SIZE(slab->cls) ? ptr : NULL;
+    }
+
+    chunk = WOF_DATA_TO_CHUNK(ptr);
+
+#ifdef WOF_THREADS
+    if (WOF_CHUNK_OWNING_BLOCK(chunk)->owner != allocator) {
+        return NULL;
+    }
+#endif /* WOF_THREADS */
+
+    if (chunk->jumbo) {
+        /* the block source may move the block, so a jumbo chunk can only
+         * 'grow' into what its block already has */
+        block = WOF_JUMBO_TO_BLOCK(chunk);
+        return size <= block->size - WOF_BLOCK_HEADER_SIZE
+            - WOF_CHUNK_HEADER_SIZE - chunk->prev ? ptr : NULL;
+    }
+
+    if (size > WOF_CHUNK_DATA_LEN(chunk)) {
+        return wof_grow_chunk(allocator, chunk, size) ? ptr : NULL;
+    }
+    else if (size < WOF_CHUNK_DATA_LEN(chunk)) {
+        wof_split_used_chunk(allocator, chunk, size);
+        wof_cycle_recycler(allocator);
+    }
+
+    return ptr;
+}
+
+/* Makes room in a string buffer for `need` bytes in all. Growth is geometric,
+ * and tries to stay in place (which it can while the master, or any free
+ * chunk, follows the buffer), first at the full new capacity and then at
+ * just what is needed, before falling back to wof_realloc. */
+static BOOL
+wof_strbuf_grow(wof_strbuf_t *buf, const size_t need)
+{
+    size_t  want;
+    char   *str;
+
+    if (need <= buf->capacity) {
+        return TRUE;
+    }
+
+    want = buf->capacity * 2;
+    if (want < WOF_STRBUF_MIN_SIZE) {
+        want = WOF_STRBUF_MIN_SIZE;
+    }
+    if (want < need) {
+        want = need;
+    }
+
+    if (buf->str) {
+        if (wof_realloc_try_in_place(buf->allocator, buf->str, want)) {
+            buf->capacity = want;
+            return TRUE;
+        }
+        if (want > need &&
+                wof_realloc_try_in_place(buf->allocator, buf->str, need)) {
+            buf->capacity = need;
+            return TRUE;
+        }
+    }
+
+    str = (char *)wof_realloc(buf->allocator, buf->str, want);
+
+    if (str == NULL) {
+        return FALSE;
+    }
+
+    buf->str      = str;
+    buf->capacity = want;
+
+    return TRUE;
+}
+
+void
+wof_strbuf_init(wof_strbuf_t *buf, wof_allocator_t *allocator)
+{
+    buf->allocator = allocator;
+    buf->str       = NULL;
+    buf->len       = 0;
+    buf->capacity  = 0;
+}
+
+int
+wof_strbuf_append_len(wof_strbuf_t *buf, const void *data, const size_t len)
+{
+    if (len >= (size_t)-1 - buf->len ||
+            !wof_strbuf_grow(buf, buf->len + len + 1)) {
+        return 0;
+    }
+
+    memcpy(buf->str + buf->len, data, len);
+    buf->len += len;
+    buf->str[buf->len] = '\0';
+
+    return 1;
+}
+
+int
+wof_strbuf_append(wof_strbuf_t *buf, const char *str)
+{
+    return wof_strbuf_append_len(buf, str, strlen(str));
+}
+
+int
+wof_strbuf_append_printf(wof_strbuf_t *buf, const char *format, ...)
+{
+    va_list ap;
+    int     len;
+
+    /* Format straight into the buffer, after making sure that it has room
+     * for a typical field. If that was not enough, make room and format
+     * again; C90 has no va_copy, but we can always just start the arguments
+     * over. Formatting is most of the cost, so it is worth a bit of slack to
+     * do it once (wof_strbuf_finalize gives the slack back anyway). A failure
+     * here is not fatal, since the output may fit regardless. */
+    wof_strbuf_grow(buf, buf->len + WOF_STRBUF_MIN_SIZE);
+
+    va_start(ap, format);
+    len = vsnprintf(buf->str ? buf->str + buf->len : NULL,
+            buf->str ? buf->capacity - buf->len : 0, format, ap);
+    va_end(ap);
+
+    if (len < 0) {
+        return 0;
+    }
+
+    if (buf->len + len + 1 > buf->capacity) {
+        if (!wof_strbuf_grow(buf, buf->len + len + 1)) {
+            if (buf->str) {
+                /* undo any partial output */
+                buf->str[buf->len] = '\0';
+            }
+            return 0;
+        }
+
+        va_start(ap, format);
+        vsnprintf(buf->str + buf->len, buf->capacity - buf->len, format, ap);
+        va_end(ap);
+    }
+
+    buf->len += len;
+
+    return 1;
+}
+
+char *
+wof_strbuf_finalize(wof_strbuf_t *buf)
+{
+    char *str;
+
+    if (buf->str == NULL) {
+        str = (char *)wof_alloc(buf->allocator, 1);
+        if (str) {
+            str[0] = '\0';
+        }
+    }
+    else {
+        /* Shrinking in place always works, and gives the unused tail back
+         * to the master if that is what follows. */
+        str = buf->str;
+        wof_realloc_try_in_place(buf->allocator, str, buf->len + 1);
+    }
+
+    wof_strbuf_init(buf, buf->allocator);
+
+    return str;
+}
+
+void
+wof_free_all(wof_allocator_t *allocator)
+{
+    wof_block_hdr_t *cur;
+
+#ifdef WOF_TRACE
+    if (allocator->trace) {
+        wof_trace_op(allocator->trace, WOF_TRACE_FREE_ALL);
+    }
+#endif /* WOF_TRACE */
+
+    WOF_PROBE1(free_all, allocator);
+
+#ifdef WOF_THREADS
+    /* anything that other threads have freed since we last looked is about
+     * to be freed anyway */
+    wof_drain_remote(allocator, TRUE);
+#endif /* WOF_THREADS */
+
+    /* the existing free lists are entirely irrelevant */
+    allocator->master_head   = NULL;
+    allocator->recycler_head = NULL;
+    allocator->nofree_arena  = NULL;
+    allocator->marks         = NULL;
+    if (allocator->tlsf) {
+        wof_tlsf_reset(allocator->tlsf);
+    }
+    allocator->stats.bytes_in_use    = 0;
+    allocator->used_chunks           = 0;
+
+    /* as are the slabs, which live in chunks that are about to be reset */
+    if (allocator->small) {
+        wof_small_reset(allocator->small);
+    }
+
+    /* jumbo blocks are never reused, so they go straight back to the OS */
+    while (allocator->jumbo_list) {
+        cur = allocator->jumbo_list;
+        allocator->jumbo_list = cur->next;
+        wof_source_release(allocator, cur);
+    }
+    allocator->stats.jumbo_blocks = 0;
+    allocator->stats.jumbo_bytes  = 0;
+
+    /* remember how many blocks this epoch needed, for wof_gc_policy */
+    allocator->peaks[allocator->epoch % WOF_GC_WINDOW] = allocator->peak_blocks;
+    allocator->cur_blocks  = 0;
+    allocator->peak_blocks = 0;
+
+    /* Rather than reinitializing every block now, start a new epoch. Every
+     * block is now stale, and will be reinitialized by wof_new_block when the
+     * master list next runs dry. */
+    allocator->epoch++;
+    allocator->stale = allocator->block_list;
+
+    if (allocator->epoch == 0) {
+        /* The epoch wrapped, so a block that has been stale for a very long
+         * time could appear current again. Restamp them all to be safe. */
+        for (cur = allocator->block_list; cur; cur = cur->next) {
+            cur->epoch = 0;
+        }
+        allocator->epoch = 1;
+    }
+}
+
+wof_mark_t *
+wof_mark(wof_allocator_t *allocator)
+{
+    wof_chunk_hdr_t *chunk;
+    wof_mark_t      *mark;
+    unsigned char   *end;
+    size_t           needed;
+
+    /* Room for the mark, and for the master chunk to keep its header and
+     * free header after the fence is split off it. */
+    needed = WOF_ALIGN_SIZE(sizeof(wof_mark_t)) + WOF_CHUNK_HEADER_SIZE
+        + WOF_FREE_HEADER_SIZE;
+
+    if (allocator->master_head &&
+            WOF_CHUNK_DATA_LEN(allocator->master_head) < needed) {
+        chunk = allocator->master_head;
+        wof_pop_master(allocator);
+        wof_add_to_recycler(allocator, chunk);
+    }
+
+    if (!allocator->master_head) {
+        wof_new_block(allocator);
+
+        if (!allocator->master_head) {
+            return NULL;
+        }
+    }
+
+    /* carve the fence off the front of the master head */
+    chunk = allocator->master_head;
+    end   = (unsigned char *)chunk + chunk->len;
+
+    wof_split_free_chunk(allocator, chunk, sizeof(wof_mark_t));
+
+    chunk->used = TRUE;
+    allocator->used_chunks++;
+    allocator->stats.bytes_in_use += chunk->len;
+
+    mark = (wof_mark_t *)WOF_CHUNK_TO_DATA(chunk);
+    mark->prev         = allocator->marks;
+    mark->end          = end;
+    mark->newest       = allocator->block_list;
+    mark->nofree_arena = allocator->nofree_arena;
+    mark->seq          = ++allocator->marks_taken;
+
+    allocator->marks        = mark;
+    allocator->nofree_arena = NULL;
+
+#ifdef WOF_TRACE
+    mark->trace_id = allocator->trace ? allocator->trace->next_id : 0;
+    if (allocator->trace) {
+        wof_trace_op(allocator->trace, WOF_TRACE_MARK);
+    }
+#endif /* WOF_TRACE */
+
+    return mark;
+}
+
+void
+wof_release_to_mark(wof_allocator_t *allocator, wof_mark_t *mark)
+{
+    wof_mark_t      *cur;
+    wof_block_hdr_t *block, *next;
+    wof_chunk_hdr_t *fence, *chunk;
+    unsigned long    count = 1;
+
+    for (cur = allocator->marks; cur != mark; cur = cur->prev) {
+        if (cur == NULL) {
+            /* already released, or discarded by a free_all */
+            return;
+        }
+        count++;
+    }
+
+#ifdef WOF_TRACE
+    if (allocator->trace) {
+        wof_trace_release(allocator->trace, mark->trace_id, count);
+    }
+#endif /* WOF_TRACE */
+
+#ifdef WOF_THREADS
+    /* frees of chunks we are about to wipe have to be done first */
+    wof_drain_remote(allocator, FALSE);
+#endif /* WOF_THREADS */
+
+    /* Any marks taken after this one are released along with it, since
+     * everything they cover was allocated after it too. */
+    allocator->marks = mark->prev;
+
+    /* jumbo blocks are stamped, and the newest are at the front */
+    while (allocator->jumbo_list &&
+            allocator->jumbo_list->epoch >= mark->seq) {
+        wof_free_jumbo_block(allocator, allocator->jumbo_list);
+    }
+
+    /* Blocks entered since the mark are emptied and left on the master stack
+     * for whatever comes next. They stay at the front of the block list, so
+     * any older mark still counts them as its own. */
+    for (block = allocator->block_list; block != mark->newest; block = next) {
+        next = block->next;
+        wof_release_chunks(allocator, WOF_BLOCK_TO_CHUNK(block), NULL);
+        wof_init_block(allocator, block);
+    }
+
+    /* Everything between the fence and the end of the old master chunk
+     * becomes a single free chunk again, and goes back on top of the master
+     * stack, so that allocation carries on from where the mark was taken. */
+    fence = WOF_DATA_TO_CHUNK(mark);
+    chunk = WOF_CHUNK_NEXT(fence);
+
+    chunk->last = wof_release_chunks(allocator, chunk, mark->end);
+    chunk->len  = (int)(mark->end - (unsigned char *)chunk);
+    chunk->used = FALSE;
+    if (!chunk->last) {
+        WOF_CHUNK_NEXT(chunk)->prev = chunk->len;
+    }
+
+    wof_push_master(allocator, chunk);
+
+    /* freeing the fence merges it into the master head, along with any free
+     * chunk to its left */
+    wof_free_chunk(allocator, fence);
+
+    allocator->nofree_arena = mark->nofree_arena;
+}
+
+/* The body of wof_gc, wof_gc_trim and wof_gc_policy. Unused blocks are either
+ * returned to their source, or (if `trim` is set) kept in place with their
+ * pages purged, until the pool is down to `keep` blocks. Pinned blocks are left
+ * alone either way, but count towards `keep`. */
+static void
+wof_gc_blocks(wof_allocator_t *allocator, const BOOL trim, const size_t keep)
+{
+    wof_block_hdr_t *cur, *next, *stale;
+    wof_chunk_hdr_t *chunk;
+    size_t           excess;
+
+#ifdef WOF_THREADS
+    /* take back anything other threads have freed, so that the blocks it
+     * lives in have a chance of being empty */
+    wof_drain_remote(allocator, FALSE);
+#endif /* WOF_THREADS */
+
+    if (allocator->marks && !trim) {
+        /* The marks find the blocks they cover by their place in the block
+         * list, so none can be released from under them. */
+        return;
+    }
+
+    /* Walk through the blocks, dealing with unused blocks. */
+    cur    = allocator->block_list;
+    stale  = NULL;
+    excess = allocator->stats.blocks > keep
+        ? allocator->stats.blocks - keep : 0;
+
+    while (cur) {
+        chunk = WOF_BLOCK_TO_CHUNK(cur);
+        next  = cur->next;
+
+        if (cur->pinned || excess == 0) {
+            /* the stale run is still a suffix of the list without the blocks
+             * released around it, and starts at the first one that is kept */
+            if (cur->epoch != allocator->epoch && stale == NULL) {
+                stale = cur;
+            }
+        }
+        else if (cur->epoch != allocator->epoch) {
+            /* Stale blocks are unused by definition, and their chunks are not
+             * in any list, so they can be dealt with directly. None of their
+             * contents matter, not even the chunk header. */
+            excess--;
+            if (trim) {
+                wof_source_purge(allocator, chunk,
+                        (unsigned char *)cur + cur->size);
+            }
+            else {
+                wof_remove_from_block_list(&allocator->block_list, cur);
+                allocator->stats.blocks--;
+                allocator->stats.block_bytes -= cur->size;
+                wof_source_release(allocator, cur);
+            }
+        }
+        else if (!chunk->used && chunk->last) {
+            /* If the first chunk is also the last, and is unused, then
+             * the block as a whole is entirely unused. */
+            excess--;
+            if (trim) {
+                /* The chunk stays in whatever list it is in, so its header
+                 * and free-header have to survive. */
+                wof_source_purge(allocator,
+                        (unsigned char *)WOF_GET_FREE(chunk)
+                            + WOF_FREE_HEADER_SIZE,
+                        (unsigned char *)cur + cur->size);
+                cur = next;
+                continue;
+            }
+
+            /* Return it to the OS and remove it from whatever lists it is
+             * in. */
+            wof_unlink_free_chunk(allocator, chunk);
+            wof_remove_from_block_list(&allocator->block_list, cur);
+            allocator->stats.blocks--;
+            allocator->stats.block_bytes -= cur->size;
+            allocator->cur_blocks--;
+            wof_source_release(allocator, cur);
+        }
+
+        cur = next;
+    }
+
+    if (!trim) {
+        /* all the stale blocks but the kept ones are gone */
+        allocator->stale = stale;
+    }
+
+    WOF_PROBE4(gc, allocator, trim, allocator->stats.blocks,
+            allocator->stats.bytes_reserved);
+}
+
+/* Unpins all but the first `keep` pinned blocks, and returns how many are
+ * still pinned. */
+static size_t
+wof_unpin_blocks(wof_allocator_t *allocator, const size_t keep)
+{
+    wof_block_hdr_t *cur;
+    size_t           pinned = 0;
+
+    for (cur = allocator->block_list; cur; cur = cur->next) {
+        if (cur->pinned) {
+            if (pinned < keep) {
+                pinned++;
+            }
+            else {
+                cur->pinned = FALSE;
+            }
+        }
+    }
+
+    return pinned;
+}
+
+int
+wof_allocator_reserve(wof_allocator_t *allocator, const size_t bytes)
+{
+    wof_block_hdr_t *block;
+    wof_chunk_hdr_t *head;
+    unsigned char   *data;
+    size_t           usable, want, pinned, i;
+
+#ifdef WOF_TRACE
+    if (allocator->trace) {
+        wof_trace_op(allocator->trace, WOF_TRACE_RESERVE);
+        wof_trace_varint(allocator->trace->out, bytes);
+    }
+#endif /* WOF_TRACE */
+
+    usable = allocator->block_size - allocator->max_colour
+        - WOF_BLOCK_HEADER_SIZE;
+    want   = bytes / usable + (bytes % usable ? 1 : 0);
+    pinned = wof_unpin_blocks(allocator, want);
+
+    /* Everything below the top of the master stack must be a whole unused
+     * block, so the new blocks go in under the current top. */
+    head = allocator->master_head;
+    if (head) {
+        allocator->master_head = WOF_GET_FREE(head)->next;
+        if (allocator->master_head) {
+            WOF_GET_FREE(allocator->master_head)->prev = NULL;
+        }
+    }
+
+    for (; pinned < want; pinned++) {
+        block = wof_source_get_coloured(allocator);
+
+        if (block == NULL) {
+            break;
+        }
+
+        /* Touch every page, so that the faults are taken now rather than by
+         * the allocations that use the block. */
+        data = (unsigned char *)block;
+        for (i = 0; i < block->size; i += WOF_PREFAULT_STRIDE) {
+            data[i] = 0;
+        }
+
+        block->pinned = TRUE;
+        wof_add_block(allocator, block);
+    }
+
+    if (head) {
+        wof_push_master(allocator, head);
+    }
+
+    return pinned == want;
+}
+
+void
+wof_gc(wof_allocator_t *allocator)
+{
+#ifdef WOF_TRACE
+    if (allocator->trace) {
+        wof_trace_op(allocator->trace, WOF_TRACE_GC);
+    }
+#endif /* WOF_TRACE */
+
+    wof_gc_blocks(allocator, FALSE, 0);
+}
+
+void
+wof_gc_trim(wof_allocator_t *allocator)
+{
+#ifdef WOF_TRACE
+    if (allocator->trace) {
+        wof_trace_op(allocator->trace, WOF_TRACE_GC_TRIM);
+    }
+#endif /* WOF_TRACE */
+
+    /* if the source has no way to drop pages but keep the memory, just give
+     * it back */
+    wof_gc_blocks(allocator, allocator->source->purge_block != NULL, 0);
+}
+
+void
+wof_gc_policy(wof_allocator_t *allocator)
+{
+    size_t keep, i;
+
+#ifdef WOF_TRACE
+    if (allocator->trace) {
+        wof_trace_op(allocator->trace, WOF_TRACE_GC_POLICY);
+    }
+#endif /* WOF_TRACE */
+
+    /* keep as many blocks as the busiest of the recent epochs needed,
+     * counting the one in progress */
+    keep = allocator->peak_blocks;
+    for (i = 0; i < WOF_GC_WINDOW; i++) {
+        if (allocator->peaks[i] > keep) {
+            keep = allocator->peaks[i];
+        }
+    }
+
+    wof_gc_blocks(allocator, FALSE, keep);
+}
+
+void
+wof_allocator_destroy(wof_allocator_t *allocator)
+{
+#ifdef WOF_TRACE
+    wof_trace_stop(allocator);
+#endif /* WOF_TRACE */
+
+    /* The combination of free_all and gc returns all our memory to the OS
+     * except for the struct itself, once nothing is pinned */
+    wof_unpin_blocks(allocator, 0);
+    wof_free_all(allocator);
+    wof_gc(allocator);
+
+    /* then just free the struct (and the small-object state and index, if
+     * any) */
+    if (allocator->small) {
+        free(allocator->small->slabs);
+    }
+    free(allocator->small);
+    free(allocator->tlsf);
+    free(allocator);
+}
+
+void
+wof_allocator_options_init(wof_allocator_options_t *options)
+{
+    options->block_size = WOF_BLOCK_SIZE;
+    options->source     = NULL;
+    options->source_ctx = NULL;
+    options->flags      = 0;
+}
+
+wof_allocator_t *
+wof_allocator_new_ex(const wof_allocator_options_t *options)
+{
+    wof_allocator_t *allocator;
+    size_t           block_size;
+
+    block_size = options->block_size
+        ? WOF_ALIGN_SIZE(options->block_size)
+        : WOF_BLOCK_SIZE;
+
+    if (block_size < WOF_MIN_BLOCK_SIZE || block_size > WOF_MAX_BLOCK_SIZE) {
+        return NULL;
+    }
+
+    allocator = (wof_allocator_t *)malloc(sizeof(wof_allocator_t));
+
+    if (allocator == NULL) {
+        return NULL;
+    }
+
+    allocator->block_list    = NULL;
+    allocator->stale         = NULL;
+    allocator->jumbo_list    = NULL;
+    allocator->master_head   = NULL;
+    allocator->recycler_head = NULL;
+    allocator->nofree_arena  = NULL;
+    allocator->tlsf          = NULL;
+    allocator->small         = NULL;
+    allocator->marks         = NULL;
+    allocator->marks_taken   = 0;
+    allocator->epoch         = 1;
+    allocator->block_size    = block_size;
+    allocator->max_colour    = 0;
+    if (!(options->flags & WOF_FLAG_NO_COLOUR)) {
+        allocator->max_colour = (block_size / 16 < WOF_COLOUR_SPAN
+                ? block_size / 16 : WOF_COLOUR_SPAN) - WOF_COLOUR_STEP;
+    }
+    /* start each pool somewhere different in the rotation, so that the first
+     * blocks of many pools don't all collide either */
+    allocator->next_colour   = (size_t)allocator / WOF_COLOUR_STEP
+        % (allocator->max_colour / WOF_COLOUR_STEP + 1) * WOF_COLOUR_STEP;
+    if (options->source) {
+        allocator->source = options->source;
+    }
+#ifdef WOF_USE_MMAP
+    else if (options->flags & WOF_FLAG_HUGE_PAGES) {
+        allocator->source = &wof_os_huge_source;
+    }
+#endif /* WOF_USE_MMAP */
+    else {
+        allocator->source = &wof_os_source;
+    }
+    allocator->source_ctx    = options->source_ctx;
+    allocator->hooks         = NULL;
+    allocator->hooks_ctx     = NULL;
+    memset(&allocator->stats, 0, sizeof(allocator->stats));
+    allocator->used_chunks   = 0;
+    allocator->cur_blocks    = 0;
+    allocator->peak_blocks   = 0;
+    memset(allocator->peaks, 0, sizeof(allocator->peaks));
+#ifdef WOF_THREADS
+    allocator->remote_blocks = NULL;
+#endif /* WOF_THREADS */
+#ifdef WOF_TRACE
+    allocator->trace         = NULL;
+#endif /* WOF_TRACE */
+
+    if (options->flags & WOF_FLAG_TLSF_INDEX) {
+        allocator->tlsf = (wof_tlsf_t *)malloc(sizeof(wof_tlsf_t));
+
+        if (allocator->tlsf == NULL) {
+            free(allocator);
+            return NULL;
+        }
+
+        wof_tlsf_reset(allocator->tlsf);
+    }
+
+#ifdef WOF_THREADS
+    /* Small objects have no header, so another thread freeing one would have
+     * no way of finding its owner. The layer is unavailable with threads. */
+#else
+    /* Slabs have to fit comfortably in a block, so the layer is also
+     * unavailable with very small blocks. */
+    if ((options->flags & WOF_FLAG_SMALL_OBJECTS) &&
+            block_size >= 4 * WOF_SLAB_SIZE) {
+        allocator->small = (wof_small_t *)malloc(sizeof(wof_small_t));
+
+        if (allocator->small == NULL) {
+            free(allocator->tlsf);
+            free(allocator);
+            return NULL;
+        }
+
+        allocator->small->slabs     = NULL;
+        allocator->small->max_slabs = 0;
+        wof_small_reset(allocator->small);
+
+        /* blocks are placed to line their first chunk's data up with a slab
+         * boundary instead of being coloured (see wof_source_get_coloured) */
+        allocator->max_colour = 2 * WOF_SLAB_SIZE - WOF_ALIGN_AMOUNT;
+    }
+#endif /* WOF_THREADS */
+
+    return allocator;
+}
+
+wof_allocator_t *
+wof_allocator_new_flags(const unsigned int flags)
+{
+    wof_allocator_options_t options;
+
+    wof_allocator_options_init(&options);
+    options.flags = flags;
 
-    /* initialize it */
-    wof_init_block(allocator, block);
+    return wof_allocator_new_ex(&options);
 }
 
-/* JUMBO ALLOCATIONS */
-
-/* Allocates special 'jumbo' blocks for sizes that won't fit normally. */
-static void *
-wof_alloc_jumbo(wof_allocator_t *allocator, const size_t size)
+void
+wof_allocator_set_hooks(wof_allocator_t *allocator,
+                        const wof_block_hooks_t *hooks, void *ctx)
 {
-    wof_block_hdr_t   *block;
-    wof_chunk_hdr_t *chunk;
+    allocator->hooks     = hooks;
+    allocator->hooks_ctx = ctx;
+}
 
-    /* allocate a new block of exactly the right size */
-    block = (wof_block_hdr_t *) malloc(size
-            + WOF_BLOCK_HEADER_SIZE
-            + WOF_CHUNK_HEADER_SIZE);
+void
+wof_fixed_source_init(wof_fixed_source_t *fixed, void *buffer,
+                      const size_t size)
+{
+    fixed->next     = (unsigned char *)WOF_ALIGN_SIZE((size_t)buffer);
+    fixed->end      = (unsigned char *)buffer + size;
+    fixed->released = NULL;
 
-    if (block == NULL) {
-        return NULL;
+    if (fixed->end < fixed->next) {
+        fixed->end = fixed->next;
     }
+}
 
-    /* add it to the block list */
-    wof_add_to_block_list(allocator, block);
-
-    /* the new block contains a single jumbo chunk */
-    chunk = WOF_BLOCK_TO_CHUNK(block);
-    chunk->last  = TRUE;
-    chunk->used  = TRUE;
-    chunk->jumbo = TRUE;
-    chunk->len   = 0;
-    chunk->prev  = 0;
+void
+wof_depot_init(wof_depot_t *depot, const size_t block_size,
+               const size_t high_water, const wof_block_source_t *source,
+               void *source_ctx)
+{
+    depot->top        = NULL;
+    depot->count      = 0;
+    depot->lock       = 0;
+    depot->high_water = high_water;
+    depot->block_size = block_size
+        ? WOF_ALIGN_SIZE(block_size)
+        : WOF_BLOCK_SIZE;
+    depot->source     = source ? source : &wof_os_source;
+    depot->source_ctx = source ? source_ctx : NULL;
+}
 
-    /* and return the data pointer */
-    return WOF_CHUNK_TO_DATA(chunk);
+void
+wof_depot_drain(wof_depot_t *depot)
+{
+    wof_depot_node_t *node, *next;
+
+    wof_depot_lock(depot);
+    node         = (wof_depot_node_t *)depot->top;
+    depot->top   = NULL;
+    depot->count = 0;
+    wof_depot_unlock(depot);
+
+    for (; node; node = next) {
+        next = node->next;
+        depot->source->release_block(depot->source_ctx, node,
+                depot->block_size);
+    }
 }
 
-/* Frees special 'jumbo' blocks of sizes that won't fit normally. */
+/* Empties every generation that has been used and whose packets have all
+ * retired, and hands its blocks back to the depot. That includes a generation
+ * that is about to be reused: in a full pipeline a generation retires just
+ * before it comes round again, so if it kept its blocks, the blocks would
+ * never move between generations. Taking them back from the depot costs
+ * little more than reinitializing them in place. */
 static void
-wof_free_jumbo(wof_allocator_t *allocator,
-               wof_chunk_hdr_t *chunk)
+wof_ring_sweep(wof_ring_t *ring)
 {
-    wof_block_hdr_t *block;
+    wof_ring_gen_t *gen;
+    size_t          i;
 
-    block = WOF_CHUNK_TO_BLOCK(chunk);
+    for (i = 0; i < ring->count; i++) {
+        gen = &ring->gens[i];
 
-    wof_remove_from_block_list(allocator, block);
+        if (!gen->dirty || WOF_RING_REFS(gen) != 0) {
+            continue;
+        }
 
-    free(block);
+        wof_free_all(gen->pool);
+        wof_gc_blocks(gen->pool, FALSE, 0);
+        gen->dirty = FALSE;
+    }
 }
 
-/* Reallocs special 'jumbo' blocks of sizes that won't fit normally. */
-static void *
-wof_realloc_jumbo(wof_allocator_t *allocator,
-                  wof_chunk_hdr_t *chunk,
-                  const size_t size)
+wof_ring_t *
+wof_ring_new(const size_t generations, const size_t packets_per_generation,
+             const wof_allocator_options_t *options)
 {
-    wof_block_hdr_t *block;
-
-    block = WOF_CHUNK_TO_BLOCK(chunk);
+    wof_allocator_options_t   pool_options;
+    const wof_block_source_t *source;
+    wof_ring_t               *ring;
+    size_t                    i;
 
-    block = (wof_block_hdr_t *) realloc(block, size
-            + WOF_BLOCK_HEADER_SIZE
-            + WOF_CHUNK_HEADER_SIZE);
-
-    if (block == NULL) {
+    if (generations == 0 || packets_per_generation == 0) {
         return NULL;
     }
 
-    if (block->next) {
-        block->next->prev = block;
-    }
-
-    if (block->prev) {
-        block->prev->next = block;
+    if (options) {
+        pool_options = *options;
     }
     else {
-        allocator->block_list = block;
+        wof_allocator_options_init(&pool_options);
     }
 
-    return WOF_CHUNK_TO_DATA(WOF_BLOCK_TO_CHUNK(block));
-}
-
-/* API */
+    ring = (wof_ring_t *)malloc(sizeof(wof_ring_t));
 
-#ifdef __cplusplus
-extern "C" {
-#endif /* __cplusplus */
+    if (ring == NULL) {
+        return NULL;
+    }
 
-void *
-wof_alloc(wof_allocator_t *allocator, const size_t size)
-{
-    wof_chunk_hdr_t *chunk;
+    ring->gens = (wof_ring_gen_t *)calloc(generations, sizeof(wof_ring_gen_t));
 
-    if (size == 0) {
+    if (ring->gens == NULL) {
+        free(ring);
         return NULL;
     }
-    else if (size > WOF_BLOCK_MAX_ALLOC_SIZE) {
-        return wof_alloc_jumbo(allocator, size);
-    }
 
-    if (allocator->recycler_head &&
-            WOF_CHUNK_DATA_LEN(allocator->recycler_head) >= size) {
+    ring->count          = generations;
+    ring->current        = 0;
+    ring->per_generation = packets_per_generation;
 
-        /* If we can serve it from the recycler, do so. */
-        chunk = allocator->recycler_head;
+    source = pool_options.source;
+#ifdef WOF_USE_MMAP
+    if (source == NULL && (pool_options.flags & WOF_FLAG_HUGE_PAGES)) {
+        source = &wof_os_huge_source;
     }
-    else {
-        if (allocator->master_head &&
-                WOF_CHUNK_DATA_LEN(allocator->master_head) < size) {
+#endif /* WOF_USE_MMAP */
 
-            /* Recycle the head of the master list if necessary. */
-            chunk = allocator->master_head;
-            wof_pop_master(allocator);
-            wof_add_to_recycler(allocator, chunk);
-        }
+    /* The depot keeps every block it is given until wof_ring_gc, so the ring
+     * holds on to its peak, as a single pool would. */
+    wof_depot_init(&ring->depot, pool_options.block_size, (size_t)-1,
+            source, pool_options.source_ctx);
 
-        if (!allocator->master_head) {
-            /* Allocate a new block if necessary. */
-            wof_new_block(allocator);
-        }
+    pool_options.block_size = ring->depot.block_size;
+    pool_options.source     = &wof_depot_source;
+    pool_options.source_ctx = &ring->depot;
 
-        chunk = allocator->master_head;
-    }
+    for (i = 0; i < generations; i++) {
+        ring->gens[i].pool = wof_allocator_new_ex(&pool_options);
 
-    if (!chunk) {
-        /* We don't have enough, and the OS wouldn't give us more. */
-        return NULL;
+        if (ring->gens[i].pool == NULL) {
+            wof_ring_destroy(ring);
+            return NULL;
+        }
     }
 
-    /* Split our chunk into two to preserve any trailing free space */
-    wof_split_free_chunk(allocator, chunk, size);
+    return ring;
+}
 
-    /* Now cycle the recycler */
-    wof_cycle_recycler(allocator);
+void
+wof_ring_destroy(wof_ring_t *ring)
+{
+    size_t i;
 
-    /* mark it as used */
-    chunk->used = TRUE;
+    for (i = 0; i < ring->count; i++) {
+        if (ring->gens[i].pool) {
+            wof_allocator_destroy(ring->gens[i].pool);
+        }
+    }
 
-    /* and return the user's pointer */
-    return WOF_CHUNK_TO_DATA(chunk);
+    wof_depot_drain(&ring->depot);
+    free(ring->gens);
+    free(ring);
 }
 
-void
-wof_free(wof_allocator_t *allocator, void *ptr)
+size_t
+wof_ring_begin(wof_ring_t *ring)
 {
-    wof_chunk_hdr_t *chunk;
+    wof_ring_gen_t *gen;
+    size_t          next;
 
-    if (ptr == NULL) {
-        return;
-    }
+    gen = &ring->gens[ring->current];
 
-    chunk = WOF_DATA_TO_CHUNK(ptr);
+    if (gen->packets >= ring->per_generation) {
+        next = (ring->current + 1) % ring->count;
 
-    if (chunk->jumbo) {
-        wof_free_jumbo(allocator, chunk);
-        return;
+        /* If the oldest generation still has packets in flight, the current
+         * one just takes this packet as well. */
+        if (WOF_RING_REFS(&ring->gens[next]) == 0) {
+            ring->current = next;
+            wof_ring_sweep(ring);
+
+            gen = &ring->gens[next];
+            gen->packets = 0;
+        }
     }
 
-    /* mark it as unused */
-    chunk->used = FALSE;
+    gen->packets++;
+    gen->dirty = TRUE;
+#ifdef WOF_THREADS
+    WOF_ATOMIC_ADD(&gen->refs, 1);
+#else /* WOF_THREADS */
+    gen->refs++;
+#endif /* WOF_THREADS */
 
-    /* merge it with any other free chunks adjacent to it, so that contiguous
-     * free space doesn't get fragmented */
-    wof_merge_free(allocator, chunk);
+    return ring->current;
+}
 
-    /* Now cycle the recycler */
-    wof_cycle_recycler(allocator);
+wof_allocator_t *
+wof_ring_pool(wof_ring_t *ring, const size_t generation)
+{
+    return ring->gens[generation].pool;
 }
 
-void *
-wof_realloc(wof_allocator_t *allocator, void *ptr, const size_t size)
+void
+wof_ring_retire(wof_ring_t *ring, const size_t generation)
 {
-    wof_chunk_hdr_t *chunk;
+#ifdef WOF_THREADS
+    WOF_ATOMIC_ADD(&ring->gens[generation].refs, (size_t)-1);
+#else /* WOF_THREADS */
+    ring->gens[generation].refs--;
+#endif /* WOF_THREADS */
+}
 
-    if (ptr == NULL) {
-        return wof_alloc(allocator, size);
+void
+wof_ring_gc(wof_ring_t *ring)
+{
+    wof_ring_sweep(ring);
+    wof_depot_drain(&ring->depot);
+}
+
+wof_allocator_t *
+wof_allocator_new()
+{
+    return wof_allocator_new_flags(0);
+}
+
+#ifdef WOF_THREADS
+wof_reclaimer_t *
+wof_reclaimer_new(const size_t block_size, const size_t high_water,
+                  const wof_block_source_t *source, void *source_ctx)
+{
+    wof_reclaimer_t *reclaimer;
+
+    reclaimer = (wof_reclaimer_t *)malloc(sizeof(wof_reclaimer_t));
+
+    if (reclaimer == NULL) {
+        return NULL;
     }
 
-    if (size == 0) {
-        wof_free(allocator, ptr);
+    wof_depot_init(&reclaimer->depot, block_size, high_water, source,
+            source_ctx);
+    reclaimer->queue = NULL;
+    reclaimer->stop  = FALSE;
+
+    if (pthread_mutex_init(&reclaimer->lock, NULL) != 0) {
+        free(reclaimer);
         return NULL;
     }
 
-    chunk = WOF_DATA_TO_CHUNK(ptr);
+    if (pthread_cond_init(&reclaimer->wake, NULL) != 0) {
+        pthread_mutex_destroy(&reclaimer->lock);
+        free(reclaimer);
+        return NULL;
+    }
 
-    if (chunk->jumbo) {
-        return wof_realloc_jumbo(allocator, chunk, size);
+    if (pthread_create(&reclaimer->thread, NULL, wof_reclaimer_main,
+                reclaimer) != 0) {
+        pthread_cond_destroy(&reclaimer->wake);
+        pthread_mutex_destroy(&reclaimer->lock);
+        free(reclaimer);
+        return NULL;
     }
 
-    if (size > WOF_CHUNK_DATA_LEN(chunk)) {
-        /* grow */
-        wof_chunk_hdr_t *tmp;
+    return reclaimer;
+}
 
-        tmp = WOF_CHUNK_NEXT(chunk);
+void
+wof_reclaimer_destroy(wof_reclaimer_t *reclaimer)
+{
+    pthread_mutex_lock(&reclaimer->lock);
+    reclaimer->stop = TRUE;
+    pthread_cond_signal(&reclaimer->wake);
+    pthread_mutex_unlock(&reclaimer->lock);
+
+    /* the helper empties the queue on its way out */
+    pthread_join(reclaimer->thread, NULL);
+
+    wof_depot_drain(&reclaimer->depot);
+    pthread_cond_destroy(&reclaimer->wake);
+    pthread_mutex_destroy(&reclaimer->lock);
+    free(reclaimer);
+}
+#endif /* WOF_THREADS */
 
-        if (tmp && (!tmp->used) &&
-            (size < WOF_CHUNK_DATA_LEN(chunk) + tmp->len)) {
-            /* the next chunk is free and has enough extra, so just grab
-             * from that */
-            size_t split_size;
+void
+wof_allocator_stats(const wof_allocator_t *allocator,
+                    wof_allocator_stats_t *stats)
+{
+    const wof_block_hdr_t *block;
+    const wof_chunk_hdr_t *chunk;
+    size_t                 largest = 0, i, j;
 
-            /* we ask for the next chunk to be split, but we don't end up
-             * using the split chunk header (it just gets merged into this one),
-             * so we want the split to be of (size - curdatalen - header_size).
-             * However, this can underflow by header_size, so we do a quick
-             * check here and floor the value to 0. */
-            split_size = size - WOF_CHUNK_DATA_LEN(chunk);
+    *stats = allocator->stats;
 
-            if (split_size < WOF_CHUNK_HEADER_SIZE) {
-                split_size = 0;
-            }
-            else {
-                split_size -= WOF_CHUNK_HEADER_SIZE;
-            }
+    stats->small_objects = allocator->small != NULL;
 
-            wof_split_free_chunk(allocator, tmp, split_size);
-
-            /* Now do a 'quickie' merge between the current block and the left-
-             * hand side of the split. Simply calling wof_merge_free
-             * might confuse things, since we may temporarily have two blocks
-             * to our right that are both free (and it isn't guaranteed to
-             * handle that case). Update our 'next' count and last flag, and
-             * our (new) successor's 'prev' count */
-            chunk->len += tmp->len;
-            chunk->last = tmp->last;
-            tmp = WOF_CHUNK_NEXT(chunk);
-            if (tmp) {
-                tmp->prev = chunk->len;
-            }
+    stats->header_bytes = stats->blocks * WOF_BLOCK_HEADER_SIZE
+        + allocator->used_chunks * WOF_CHUNK_HEADER_SIZE
+        + stats->jumbo_blocks * (WOF_BLOCK_HEADER_SIZE + WOF_CHUNK_HEADER_SIZE);
+    stats->bytes_free = stats->block_bytes
+        - stats->blocks * WOF_BLOCK_HEADER_SIZE
+        - stats->bytes_in_use;
 
-            /* Now cycle the recycler */
-            wof_cycle_recycler(allocator);
+    /* Stale blocks are entirely free, and aren't in any list. */
+    for (block = allocator->stale; block; block = block->next) {
+        if (block->size - WOF_BLOCK_HEADER_SIZE > largest) {
+            largest = block->size - WOF_BLOCK_HEADER_SIZE;
+        }
+    }
 
-            /* And return the same old pointer */
-            return ptr;
+    for (chunk = allocator->master_head; chunk;
+            chunk = WOF_GET_FREE(chunk)->next) {
+        if ((size_t)chunk->len > largest) {
+            largest = chunk->len;
         }
-        else {
-            /* no room to grow, need to alloc, copy, free */
-            void *newptr;
+    }
 
-            newptr = wof_alloc(allocator, size);
-            if (newptr == NULL) {
-                return NULL;
+    stats->recycler_length = 0;
+
+    if (allocator->tlsf) {
+        for (i = 0; i < WOF_TLSF_FL_COUNT; i++) {
+            for (j = 0; j < WOF_TLSF_SL_COUNT; j++) {
+                for (chunk = allocator->tlsf->lists[i][j]; chunk;
+                        chunk = WOF_GET_FREE(chunk)->next) {
+                    if ((size_t)chunk->len > largest) {
+                        largest = chunk->len;
+                    }
+                    stats->recycler_length++;
+                }
             }
-            memcpy(newptr, ptr, WOF_CHUNK_DATA_LEN(chunk));
-            wof_free(allocator, ptr);
-
-            /* No need to cycle the recycler, alloc and free both did that
-             * already */
-
-            return newptr;
         }
     }
-    else if (size < WOF_CHUNK_DATA_LEN(chunk)) {
-        /* shrink */
-        wof_split_used_chunk(allocator, chunk, size);
-
-        /* Now cycle the recycler */
-        wof_cycle_recycler(allocator);
 
-        return ptr;
+    chunk = allocator->recycler_head;
+    if (chunk) {
+        do {
+            if ((size_t)chunk->len > largest) {
+                largest = chunk->len;
+            }
+            stats->recycler_length++;
+            chunk = WOF_GET_FREE(chunk)->next;
+        } while (chunk != allocator->recycler_head);
     }
 
-    /* no-op */
-    return ptr;
+    stats->largest_free  = largest ? largest - WOF_CHUNK_HEADER_SIZE : 0;
+    stats->fragmentation = stats->bytes_free
+        ? 1.0 - (double)largest / stats->bytes_free
+        : 0.0;
 }
 
-void
-wof_free_all(wof_allocator_t *allocator)
+#ifdef WOF_TRACE
+int
+wof_trace_start(wof_allocator_t *allocator, FILE *out)
 {
-    wof_block_hdr_t *cur;
-    wof_chunk_hdr_t *chunk;
+    wof_trace_t *trace;
 
-    /* the existing free lists are entirely irrelevant */
-    allocator->master_head   = NULL;
-    allocator->recycler_head = NULL;
+    wof_trace_stop(allocator);
 
-    /* iterate through the blocks, reinitializing each one */
-    cur = allocator->block_list;
+    trace = (wof_trace_t *)malloc(sizeof(wof_trace_t));
 
-    while (cur) {
-        chunk = WOF_BLOCK_TO_CHUNK(cur);
-        if (chunk->jumbo) {
-            wof_remove_from_block_list(allocator, cur);
-            cur = cur->next;
-            free(WOF_CHUNK_TO_BLOCK(chunk));
-        }
-        else {
-            wof_init_block(allocator, cur);
-            cur = cur->next;
-        }
+    if (trace == NULL) {
+        return 0;
     }
-}
-
-void
-wof_gc(wof_allocator_t *allocator)
-{
-    wof_block_hdr_t *cur, *next;
-    wof_chunk_hdr_t *chunk;
-    wof_free_hdr_t  *free_chunk;
 
-    /* Walk through the blocks, adding used blocks to the new list and
-     * completely destroying unused blocks. */
-    cur = allocator->block_list;
-    allocator->block_list = NULL;
+    trace->out      = out;
+    trace->busy     = FALSE;
+    trace->next_id  = 1;
+    trace->map      = NULL;
+    trace->count    = 0;
+    trace->capacity = 0;
 
-    while (cur) {
-        chunk = WOF_BLOCK_TO_CHUNK(cur);
-        next  = cur->next;
+    fwrite(WOF_TRACE_MAGIC, 1, 4, out);
+    putc(WOF_TRACE_VERSION, out);
 
-        if (!chunk->jumbo && !chunk->used && chunk->last) {
-            /* If the first chunk is also the last, and is unused, then
-             * the block as a whole is entirely unused, so return it to
-             * the OS and remove it from whatever lists it is in. */
-            free_chunk = WOF_GET_FREE(chunk);
-            if (free_chunk->next) {
-                WOF_GET_FREE(free_chunk->next)->prev = free_chunk->prev;
-            }
-            if (free_chunk->prev) {
-                WOF_GET_FREE(free_chunk->prev)->next = free_chunk->next;
-            }
-            if (allocator->recycler_head == chunk) {
-                if (free_chunk->next == chunk) {
-                    allocator->recycler_head = NULL;
-                }
-                else {
-                    allocator->recycler_head = free_chunk->next;
-                }
-            }
-            else if (allocator->master_head == chunk) {
-                allocator->master_head = free_chunk->next;
-            }
-            free(cur);
-        }
-        else {
-            /* part of this block is used, so add it to the new block list */
-            wof_add_to_block_list(allocator, cur);
-        }
+    allocator->trace = trace;
 
-        cur = next;
-    }
+    return 1;
 }
 
 void
-wof_allocator_destroy(wof_allocator_t *allocator)
-{
-    /* The combination of free_all and gc returns all our memory to the OS
-     * except for the struct itself */
-    wof_free_all(allocator);
-    wof_gc(allocator);
-
-    /* then just free the struct */
-    free(allocator);
-}
-
-wof_allocator_t *
-wof_allocator_new()
+wof_trace_stop(wof_allocator_t *allocator)
 {
-    wof_allocator_t *allocator;
-
-    allocator = (wof_allocator_t *)malloc(sizeof(wof_allocator_t));
-
-    if (allocator == NULL) {
-        return NULL;
+    if (allocator->trace == NULL) {
+        return;
     }
 
-    allocator->block_list    = NULL;
-    allocator->master_head   = NULL;
-    allocator->recycler_head = NULL;
-
-    return allocator;
+    fflush(allocator->trace->out);
+    free(allocator->trace->map);
+    free(allocator->trace);
+    allocator->trace = NULL;
 }
+#endif /* WOF_TRACE */
 
 #ifdef __cplusplus
 }
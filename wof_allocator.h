@@ -7,33 +7,426 @@
 
 #include <string.h>
 
+#ifdef WOF_TRACE
+#include <stdio.h>
+#endif /* WOF_TRACE */
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
 typedef struct _wof_allocator_t wof_allocator_t;
 
+/* A position in a pool, returned by wof_mark. */
+typedef struct _wof_mark_t wof_mark_t;
+
+/* A ring of generational pools, created by wof_ring_new. */
+typedef struct _wof_ring_t wof_ring_t;
+
+/* Flags for wof_allocator_new_flags and wof_allocator_options_t */
+
+/* Serve requests of up to 256 bytes from size-classed slabs, without a
+ * per-object header. The layer is not available when built with WOF_THREADS
+ * or for block sizes under 16KB; the flag is then ignored, and the pool works
+ * as if it had not been given. The small_objects field of
+ * wof_allocator_stats_t says whether a pool has the layer. */
+#define WOF_FLAG_SMALL_OBJECTS 0x01
+
+/* Keep free chunks in an index of segregated lists (TLSF-style), which always
+ * finds a fitting free chunk if there is one, instead of in the recycler,
+ * which only ever looks at its head. */
+#define WOF_FLAG_TLSF_INDEX    0x02
+
+/* With WOF_USE_MMAP, map ordinary blocks of at least a huge page with huge
+ * pages where possible (see the readme). Ignored otherwise, or if the pool has
+ * its own block source. */
+#define WOF_FLAG_HUGE_PAGES    0x04
+
+/* Start every block's header right at the start of its memory, rather than
+ * colouring blocks by starting each one's header a different number of cache
+ * lines in (see the readme). */
+#define WOF_FLAG_NO_COLOUR     0x08
+
+/* The range of block sizes a pool can be created with. Building with
+ * WOF_WIDE_HEADER gives chunks a full int for their length, which raises the
+ * limit to 1GB. */
+#define WOF_MIN_BLOCK_SIZE (4 * 1024)
+#ifdef WOF_WIDE_HEADER
+#define WOF_MAX_BLOCK_SIZE (1024 * 1024 * 1024)
+#else /* WOF_WIDE_HEADER */
+#define WOF_MAX_BLOCK_SIZE (128 * 1024 * 1024)
+#endif /* WOF_WIDE_HEADER */
+
+/* Where a pool gets its blocks from. get_block and release_block are
+ * required. resize_block may be NULL (or fail), in which case jumbo blocks are
+ * resized by getting a new block and copying. purge_block may be NULL; if it
+ * is set, the source may discard the contents of the given range of a block
+ * that the pool is keeping but not using (see wof_gc_trim). */
+typedef struct _wof_block_source_t {
+    void *(*get_block)(void *ctx, const size_t size);
+    void  (*release_block)(void *ctx, void *block, const size_t size);
+    void *(*resize_block)(void *ctx, void *block,
+                          const size_t old_size, const size_t new_size);
+    void  (*purge_block)(void *ctx, void *start, const size_t len);
+} wof_block_source_t;
+
+/* Callbacks for a pool's traffic with its block source, for telemetry (see
+ * wof_allocator_set_hooks). Either may be NULL. acquire is called with each
+ * block the pool gets from its source, and release with each block it hands
+ * back, with the pointer and size the source saw. A jumbo block that is
+ * resized is released and then acquired again. Both are called on the pool's
+ * thread, and must not call back into the pool. */
+typedef struct _wof_block_hooks_t {
+    void (*acquire)(void *ctx, wof_allocator_t *allocator, void *block,
+                    const size_t size);
+    void (*release)(void *ctx, wof_allocator_t *allocator, void *block,
+                    const size_t size);
+} wof_block_hooks_t;
+
+/* A source that carves blocks out of a single caller-supplied buffer. Set one
+ * up with wof_fixed_source_init and pass it as the source context, along with
+ * &wof_fixed_source. The buffer must outlive the pool. */
+typedef struct _wof_fixed_source_t {
+    unsigned char *next;
+    unsigned char *end;
+    void          *released;
+} wof_fixed_source_t;
+
+extern const wof_block_source_t wof_fixed_source;
+
+/* A depot of empty blocks that any number of pools can share (from any number
+ * of threads, when built with WOF_THREADS), so that new pools start on blocks
+ * that are already faulted in and pools being collected or destroyed do not
+ * hand their blocks back to the OS. Released blocks of exactly the depot's
+ * block size are kept, up to high_water of them; everything else goes
+ * straight through to the underlying source. Set one up with wof_depot_init
+ * and pass it as the source context, along with &wof_depot_source, to pools
+ * of the same block size. wof_depot_drain releases every block it holds. */
+typedef struct _wof_depot_t {
+    void                     *top;
+    size_t                    count;
+    int                       lock;
+    size_t                    high_water;
+    size_t                    block_size;
+    const wof_block_source_t *source;
+    void                     *source_ctx;
+} wof_depot_t;
+
+extern const wof_block_source_t wof_depot_source;
+
+#ifdef WOF_THREADS
+/* A source that takes the cost of giving blocks back (unmapping or freeing
+ * them, or purging their pages) off the threads that run the pools. Only
+ * available when built with WOF_THREADS, and needs POSIX threads. Released
+ * blocks are handed to a helper thread, which keeps up to high_water blocks
+ * of the given size for reuse (purged, if the underlying source can do that)
+ * and gives back the rest. Create one with wof_reclaimer_new and pass it as
+ * the source context, along with &wof_reclaimer_source, to any number of
+ * pools, which must all be destroyed before it is. */
+typedef struct _wof_reclaimer_t wof_reclaimer_t;
+
+extern const wof_block_source_t wof_reclaimer_source;
+#endif /* WOF_THREADS */
+
+/* A growable buffer in a pool, for building strings and byte arrays. Set one
+ * up with wof_strbuf_init; `str` is then NULL until something is appended,
+ * and is NUL-terminated after that. Appending grows the buffer in place where
+ * there is free space right behind it, which there usually is when the buffer
+ * was the last thing carved from the pool, and copies it only when there is
+ * not. The append functions return 0, leaving the buffer as it was, if they
+ * could not make room. wof_strbuf_finalize trims the buffer to fit, hands it
+ * over (as an ordinary allocation from the pool, which is "" for an empty
+ * buffer, or NULL if even that could not be allocated) and resets `buf`. */
+typedef struct _wof_strbuf_t {
+    wof_allocator_t *allocator;
+    char            *str;
+    size_t           len;
+    size_t           capacity;
+} wof_strbuf_t;
+
+/* Options for wof_allocator_new_ex. Initialize with wof_allocator_options_init
+ * and then change whatever is needed. A NULL source means the default. */
+typedef struct _wof_allocator_options_t {
+    size_t                    block_size;
+    const wof_block_source_t *source;
+    void                     *source_ctx;
+    unsigned int              flags;
+} wof_allocator_options_t;
+
+/* A snapshot of a pool, filled in by wof_allocator_stats. Everything is
+ * maintained as the pool runs, except for bytes_free, largest_free,
+ * recycler_length and fragmentation, which are worked out on each call by
+ * walking the free lists (so the call is not constant-time).
+ *
+ * bytes_reserved is everything held from the block source, and is split into
+ * ordinary blocks (including unused ones kept for reuse) and jumbo blocks.
+ * The few bytes skipped at the start of each coloured block are left out.
+ * bytes_in_use counts allocated chunks, including their headers and alignment
+ * padding, in ordinary blocks; header_bytes is the block and chunk headers of
+ * the memory in use, jumbo blocks included. Slabs of the small-object layer
+ * count as in use in full. bytes_free is the free space in ordinary blocks,
+ * and largest_free the largest request it could serve without another block.
+ * fragmentation is 1 - (largest free chunk / bytes_free), so 0 means all the
+ * free space is in a single chunk.
+ *
+ * bytes_requested is the total of all sizes ever passed to wof_alloc
+ * (including the allocations made by reallocs that moved). The hit counters
+ * say how ordinary (not jumbo, not small) allocations were served: from the
+ * recycler, from the top of the master stack, or from a block that had to be
+ * (re)initialized first.
+ *
+ * small_objects is non-zero if the pool has the small-object layer, which it
+ * may not have even if it was asked for (see WOF_FLAG_SMALL_OBJECTS). */
+typedef struct _wof_allocator_stats_t {
+    size_t        bytes_reserved;
+    size_t        blocks;
+    size_t        block_bytes;
+    size_t        jumbo_blocks;
+    size_t        jumbo_bytes;
+
+    size_t        bytes_in_use;
+    size_t        header_bytes;
+    size_t        bytes_free;
+    size_t        largest_free;
+    size_t        recycler_length;
+    double        fragmentation;
+
+    unsigned long bytes_requested;
+    unsigned long recycler_hits;
+    unsigned long master_hits;
+    unsigned long new_block_hits;
+
+    int           small_objects;
+} wof_allocator_stats_t;
+
+/* The trace format written by wof_trace_start. A trace is the four bytes
+ * "WOFT", a version byte, and then one record per call: an opcode byte
+ * followed by its operands as unsigned LEB128 varints. Pointers are replaced
+ * by object IDs, which are handed out sequentially (starting at 1) to the
+ * results of alloc and realloc, whether they succeeded or not. An object is
+ * referred to by the delta between the next ID to be handed out and its own,
+ * so recent objects cost a single byte; a delta of 0 stands for NULL or for a
+ * pointer that was allocated before tracing started.
+ *
+ *   ALLOC          size
+ *   FREE           object
+ *   REALLOC        object size
+ *   FREE_ALL, GC, GC_TRIM, GC_POLICY
+ *   ALLOC_ALIGNED  size alignment
+ *   ALLOC_NOFREE   size
+ *   MARK
+ *   RELEASE        count
+ *   RESERVE        bytes
+ *
+ * A RELEASE gives the number of marks it pops: 1 for the newest mark, 2 for
+ * the one before it, and so on. Every object whose memory was allocated since
+ * that mark dies; an object that a realloc did not move keeps its memory.
+ * A successful wof_realloc_try_in_place is recorded as a REALLOC, and a
+ * failed one not at all.
+ */
+#define WOF_TRACE_MAGIC         "WOFT"
+#define WOF_TRACE_VERSION       1
+
+#define WOF_TRACE_ALLOC         1
+#define WOF_TRACE_FREE          2
+#define WOF_TRACE_REALLOC       3
+#define WOF_TRACE_FREE_ALL      4
+#define WOF_TRACE_GC            5
+#define WOF_TRACE_GC_TRIM       6
+#define WOF_TRACE_ALLOC_ALIGNED 7
+#define WOF_TRACE_ALLOC_NOFREE  8
+#define WOF_TRACE_MARK          9
+#define WOF_TRACE_RELEASE       10
+#define WOF_TRACE_RESERVE       11
+#define WOF_TRACE_GC_POLICY     12
+
 void *
 wof_alloc(wof_allocator_t *allocator, const size_t size);
 
+/* Allocates `size` bytes aligned to `alignment`, which must be a power of
+ * two. The result can be passed to wof_free and wof_realloc like any other,
+ * but a realloc that has to move it only keeps the default alignment. */
+void *
+wof_alloc_aligned(wof_allocator_t *allocator,
+                  const size_t size,
+                  const size_t alignment);
+
+/* Allocates `size` bytes that will only ever be freed by wof_free_all, with
+ * no per-object header. The result must not be passed to wof_free or
+ * wof_realloc. */
+void *
+wof_alloc_nofree(wof_allocator_t *allocator, const size_t size);
+
 void
 wof_free(wof_allocator_t *allocator, void *ptr);
 
 void *
 wof_realloc(wof_allocator_t *allocator, void *ptr, const size_t size);
 
+/* Resizes the buffer at `ptr` only if that can be done without moving it,
+ * and returns `ptr` if so. Otherwise returns NULL and leaves the buffer alone
+ * (as it does for a NULL `ptr` or a `size` of 0). */
+void *
+wof_realloc_try_in_place(wof_allocator_t *allocator, void *ptr,
+                         const size_t size);
+
+void
+wof_strbuf_init(wof_strbuf_t *buf, wof_allocator_t *allocator);
+
+int
+wof_strbuf_append(wof_strbuf_t *buf, const char *str);
+
+int
+wof_strbuf_append_len(wof_strbuf_t *buf, const void *data, const size_t len);
+
+/* Appends printf-style formatted output. */
+int
+wof_strbuf_append_printf(wof_strbuf_t *buf, const char *format, ...);
+
+char *
+wof_strbuf_finalize(wof_strbuf_t *buf);
+
 void
 wof_free_all(wof_allocator_t *allocator);
 
+/* Marks the current position in the pool, or returns NULL if there is no
+ * memory for the mark. wof_release_to_mark frees everything allocated since
+ * the mark was taken (including objects moved there by a realloc), and pops
+ * the mark along with any taken after it. Marks nest, and a wof_free_all
+ * discards them all; releasing a mark that is no longer active does nothing.
+ * While any mark is active, allocations are carved from fresh memory rather
+ * than from chunks freed before (or small-object slabs), and wof_gc does
+ * nothing. */
+wof_mark_t *
+wof_mark(wof_allocator_t *allocator);
+
+void
+wof_release_to_mark(wof_allocator_t *allocator, wof_mark_t *mark);
+
+/* Makes sure the pool holds enough pinned blocks to serve `bytes` (in whole
+ * blocks) without faulting: new blocks are taken from the source, have all
+ * their pages touched, and are put on the master stack. Pinned blocks are
+ * never given back or purged by wof_gc and wof_gc_trim, so the reservation
+ * survives them, and the first allocations after one (or after startup) don't
+ * stall on fresh memory. A smaller reservation than before unpins the
+ * surplus, and 0 drops it altogether. Returns 0 if the source ran out, having
+ * pinned what it could. */
+int
+wof_allocator_reserve(wof_allocator_t *allocator, const size_t bytes);
+
 void
 wof_gc(wof_allocator_t *allocator);
 
+void
+wof_gc_trim(wof_allocator_t *allocator);
+
+/* Like wof_gc, but keeps as many blocks as the pool needed at its busiest
+ * over the last WOF_GC_WINDOW wof_free_all cycles (and the current one), and
+ * gives back only the unused blocks beyond that. Called after every burst,
+ * it lets the pool shrink once its bursts have been smaller for a while,
+ * without giving back blocks that the next burst will only have to get
+ * again. Pinned blocks count towards what is kept. */
+void
+wof_gc_policy(wof_allocator_t *allocator);
+
 void
 wof_allocator_destroy(wof_allocator_t *allocator);
 
 wof_allocator_t *
 wof_allocator_new();
 
+wof_allocator_t *
+wof_allocator_new_flags(const unsigned int flags);
+
+void
+wof_allocator_options_init(wof_allocator_options_t *options);
+
+wof_allocator_t *
+wof_allocator_new_ex(const wof_allocator_options_t *options);
+
+/* Installs (or, given NULL, removes) a pool's block hooks. */
+void
+wof_allocator_set_hooks(wof_allocator_t *allocator,
+                        const wof_block_hooks_t *hooks, void *ctx);
+
+void
+wof_fixed_source_init(wof_fixed_source_t *fixed, void *buffer,
+                      const size_t size);
+
+/* A block size of 0 means the default, and a NULL source means the default
+ * source. */
+void
+wof_depot_init(wof_depot_t *depot, const size_t block_size,
+               const size_t high_water, const wof_block_source_t *source,
+               void *source_ctx);
+
+void
+wof_depot_drain(wof_depot_t *depot);
+
+/* A ring of `generations` pools for pipelines, in which a packet's memory has
+ * to live until the packet leaves the last stage and many packets are in
+ * flight at once. wof_ring_begin assigns a packet to a generation, whose pool
+ * (wof_ring_pool) the packet allocates from until it is passed to
+ * wof_ring_retire. Each generation takes `packets_per_generation` packets
+ * (more, if the generation after it still has packets in flight), and is
+ * freed in one go once they have all retired. The pools are created with
+ * `options` (or the defaults, for NULL) and share their blocks, so a freed
+ * generation's blocks go to the next generation to need them rather than back
+ * to the source. wof_ring_gc hands back whatever blocks are not in use.
+ *
+ * wof_ring_begin, wof_ring_gc and wof_ring_destroy must all be called from
+ * the same thread. With WOF_THREADS, wof_ring_pool and wof_ring_retire may be
+ * called from any thread, but a generation's pool is not locked, so its
+ * packets must not be worked on by several threads at once. One packet per
+ * generation is the simplest way to ensure this. */
+wof_ring_t *
+wof_ring_new(const size_t generations, const size_t packets_per_generation,
+             const wof_allocator_options_t *options);
+
+void
+wof_ring_destroy(wof_ring_t *ring);
+
+size_t
+wof_ring_begin(wof_ring_t *ring);
+
+wof_allocator_t *
+wof_ring_pool(wof_ring_t *ring, const size_t generation);
+
+void
+wof_ring_retire(wof_ring_t *ring, const size_t generation);
+
+void
+wof_ring_gc(wof_ring_t *ring);
+
+#ifdef WOF_THREADS
+/* A block size of 0 means the default, and a NULL source means the default
+ * source. Returns NULL if the helper thread could not be started. */
+wof_reclaimer_t *
+wof_reclaimer_new(const size_t block_size, const size_t high_water,
+                  const wof_block_source_t *source, void *source_ctx);
+
+void
+wof_reclaimer_destroy(wof_reclaimer_t *reclaimer);
+#endif /* WOF_THREADS */
+
+void
+wof_allocator_stats(const wof_allocator_t *allocator,
+                    wof_allocator_stats_t *stats);
+
+#ifdef WOF_TRACE
+/* Tracing is only available when built with WOF_TRACE. wof_trace_start
+ * records every subsequent call on the pool to `out`, replacing any trace
+ * already in progress, and returns 0 if it could not allocate its state.
+ * Objects allocated before the trace started are unknown to it, so start on a
+ * fresh pool or just after a wof_free_all. wof_trace_stop flushes `out` but
+ * does not close it. */
+int
+wof_trace_start(wof_allocator_t *allocator, FILE *out);
+
+void
+wof_trace_stop(wof_allocator_t *allocator);
+#endif /* WOF_TRACE */
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
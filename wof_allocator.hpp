@@ -0,0 +1,211 @@
+/* Wheel-of-Fortune Memory Allocator - C++ adapters
+ * Copyright 2013, Evan Huus <eapache@gmail.com>
+ *
+ * Header-only wrappers for using a pool from C++:
+ *  - wof::pool_resource, a std::pmr::memory_resource (C++17) backed by a pool,
+ *    for std::pmr containers;
+ *  - wof::allocator<T>, a stateful allocator for the ordinary containers;
+ *  - wof::free_all_guard, which calls wof_free_all when it goes out of scope.
+ *
+ * The allocator itself is still built as C; this header needs C++11, and
+ * C++17 for pool_resource.
+ */
+
+#ifndef __WOF_ALLOCATOR_HPP__
+#define __WOF_ALLOCATOR_HPP__
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <stdexcept>
+
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+
+#include "wof_allocator.h"
+
+namespace wof {
+
+/* Everything wof_alloc returns is aligned to this much, like malloc. Anything
+ * more goes through wof_alloc_aligned. */
+static const std::size_t default_alignment = 2 * sizeof(std::size_t);
+
+namespace detail {
+
+inline void *
+allocate(wof_allocator_t *pool, std::size_t bytes, std::size_t alignment)
+{
+    void *ptr;
+
+    /* wof_alloc returns NULL for 0 bytes, but C++ wants a unique pointer */
+    if (bytes == 0) {
+        bytes = 1;
+    }
+
+    ptr = alignment <= default_alignment
+        ? wof_alloc(pool, bytes)
+        : wof_alloc_aligned(pool, bytes, alignment);
+
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+} /* namespace detail */
+
+/* Calls wof_free_all on a pool when it goes out of scope, so that per-packet
+ * code cannot forget to (or return early without doing so). Everything
+ * allocated from the pool, by containers or otherwise, must be dead by then. */
+class free_all_guard {
+public:
+    explicit free_all_guard(wof_allocator_t *pool) : pool_(pool) {}
+    ~free_all_guard() { wof_free_all(pool_); }
+
+    free_all_guard(const free_all_guard &) = delete;
+    free_all_guard &operator=(const free_all_guard &) = delete;
+
+private:
+    wof_allocator_t *pool_;
+};
+
+/* A stateful allocator for standard containers. Copies (and rebinds) share
+ * the pool, and compare equal exactly when they do. The pool must outlive
+ * every container using it, unless the containers are simply abandoned to a
+ * wof_free_all. */
+template <typename T>
+class allocator {
+public:
+    typedef T           value_type;
+    typedef std::size_t size_type;
+
+    explicit allocator(wof_allocator_t *pool) : pool_(pool) {}
+
+    template <typename U>
+    allocator(const allocator<U> &other) : pool_(other.pool()) {}
+
+    T *
+    allocate(size_type n)
+    {
+        if (n > std::numeric_limits<size_type>::max() / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(detail::allocate(pool_, n * sizeof(T),
+                    alignof(T)));
+    }
+
+    void
+    deallocate(T *ptr, size_type)
+    {
+        wof_free(pool_, ptr);
+    }
+
+    wof_allocator_t *pool() const { return pool_; }
+
+private:
+    wof_allocator_t *pool_;
+};
+
+template <typename T, typename U>
+inline bool
+operator==(const allocator<T> &a, const allocator<U> &b)
+{
+    return a.pool() == b.pool();
+}
+
+template <typename T, typename U>
+inline bool
+operator!=(const allocator<T> &a, const allocator<U> &b)
+{
+    return a.pool() != b.pool();
+}
+
+#if __cplusplus >= 201703L
+
+/* Tag for wrapping an existing pool rather than creating one, so that
+ * pool_resource(wof::adopt, pool) cannot be confused with the flags. */
+struct adopt_t {
+    explicit adopt_t() = default;
+};
+
+inline constexpr adopt_t adopt{};
+
+/* A memory resource backed by a pool, either one it creates (and destroys)
+ * itself or one it is handed with wof::adopt (and leaves alone). release()
+ * frees everything at once, like std::pmr::monotonic_buffer_resource::release.
+ *
+ * In release-only mode do_deallocate does nothing, so containers that die with
+ * the pool don't pay for freeing their memory piece by piece; it all comes
+ * back with the next release() (or wof_free_all). That is only worth it when
+ * the containers don't churn, since nothing freed in the meantime is reused. */
+class pool_resource : public std::pmr::memory_resource {
+public:
+    explicit pool_resource(unsigned int flags = 0)
+        : pool_(wof_allocator_new_flags(flags)), owned_(true),
+          release_only_(false)
+    {
+        if (pool_ == NULL) {
+            throw std::bad_alloc();
+        }
+    }
+
+    pool_resource(adopt_t, wof_allocator_t *pool)
+        : pool_(pool), owned_(false), release_only_(false)
+    {
+        if (pool_ == NULL) {
+            throw std::invalid_argument("wof::pool_resource: NULL pool");
+        }
+    }
+
+    pool_resource(const pool_resource &) = delete;
+    pool_resource &operator=(const pool_resource &) = delete;
+
+    ~pool_resource()
+    {
+        if (owned_) {
+            wof_allocator_destroy(pool_);
+        }
+    }
+
+    void release() { wof_free_all(pool_); }
+
+    void set_release_only(bool on) { release_only_ = on; }
+    bool release_only() const { return release_only_; }
+
+    wof_allocator_t *pool() const { return pool_; }
+
+protected:
+    void *
+    do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return detail::allocate(pool_, bytes, alignment);
+    }
+
+    void
+    do_deallocate(void *ptr, std::size_t, std::size_t) override
+    {
+        if (!release_only_) {
+            wof_free(pool_, ptr);
+        }
+    }
+
+    bool
+    do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    wof_allocator_t *pool_;
+    bool             owned_;
+    bool             release_only_;
+};
+
+#endif /* __cplusplus >= 201703L */
+
+} /* namespace wof */
+
+#endif /* __WOF_ALLOCATOR_HPP__ */
+
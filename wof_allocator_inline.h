@@ -0,0 +1,327 @@
+/* Wheel-of-Fortune Memory Allocator - inline fast path
+ * Copyright 2013, Evan Huus <eapache@gmail.com>
+ *
+ * The layout of a pool and of its chunks, which wof_allocator.c shares with
+ * wof_alloc_inline below. Code that includes this header must be built with
+ * the same WOF_* options as the allocator itself, since they change the
+ * layout. Nothing else should depend on what is in here.
+ */
+
+#ifndef __WOF_ALLOCATOR_INLINE_H__
+#define __WOF_ALLOCATOR_INLINE_H__
+
+#include "wof_allocator.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* C90 has no inline, but every compiler we care about has it anyway. */
+#if defined(__cplusplus) || \
+        (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+#define WOF_INLINE static inline
+#elif defined(__GNUC__)
+#define WOF_INLINE static __inline__
+#else
+#define WOF_INLINE static
+#endif
+
+/* When built with WOF_USDT, the allocator has USDT probes (from systemtap's
+ * sys/sdt.h) under the provider name "wof", for bpftrace, perf and the like
+ * to attach to; see the readme for the list. Otherwise they compile to
+ * nothing at all. */
+#ifdef WOF_USDT
+#include <sys/sdt.h>
+#define WOF_PROBE1(NAME, A)          DTRACE_PROBE1(wof, NAME, A)
+#define WOF_PROBE2(NAME, A, B)       DTRACE_PROBE2(wof, NAME, A, B)
+#define WOF_PROBE3(NAME, A, B, C)    DTRACE_PROBE3(wof, NAME, A, B, C)
+#define WOF_PROBE4(NAME, A, B, C, D) DTRACE_PROBE4(wof, NAME, A, B, C, D)
+#else /* WOF_USDT */
+#define WOF_PROBE1(NAME, A)
+#define WOF_PROBE2(NAME, A, B)
+#define WOF_PROBE3(NAME, A, B, C)
+#define WOF_PROBE4(NAME, A, B, C, D)
+#endif /* WOF_USDT */
+
+/* https://mail.gnome.org/archives/gtk-devel-list/2004-December/msg00091.html
+ * The 2*sizeof(size_t) alignment here is borrowed from GNU libc, so it should
+ * be good most everywhere. It is more conservative than is needed on some
+ * 64-bit platforms, but ia64 does require a 16-byte alignment. The SIMD
+ * extensions for x86 and ppc32 would want a larger alignment than this, but
+ * we don't need to do better than malloc by default; wof_alloc_aligned is
+ * there for buffers that need more.
+ */
+#define WOF_ALIGN_AMOUNT (2 * sizeof (size_t))
+#define WOF_ALIGN_SIZE(SIZE) ((~(WOF_ALIGN_AMOUNT-1)) & \
+        ((SIZE) + (WOF_ALIGN_AMOUNT-1)))
+
+/* The header for a single 'chunk' of memory as returned from alloc/realloc.
+ * The 'jumbo' flag indicates an allocation larger than a normal-sized block
+ * would be capable of serving. If this is set, it is the only chunk in the
+ * block and the other chunk header fields are irrelevant, except for 'prev',
+ * which holds the distance the chunk was moved along from the start of the
+ * block to align its data (normally 0).
+ *
+ * With WOF_THREADS the header also holds the offset of the chunk from the
+ * start of its block, so that a thread freeing the chunk can find its owner.
+ * On 64-bit platforms this fits in what would otherwise be alignment padding.
+ *
+ * With WOF_WIDE_HEADER the length gets an int of its own instead of sharing
+ * one with the flags, so blocks can be up to 1GB. That too fits in the padding
+ * on 64-bit platforms; on 32-bit ones it costs a word per chunk.
+ */
+typedef struct _wof_chunk_hdr_t {
+    int prev;
+
+    /* flags */
+    int last:1;
+    int used:1;
+    int jumbo:1;
+
+#ifdef WOF_WIDE_HEADER
+    int len;
+#else /* WOF_WIDE_HEADER */
+    int len:29;
+#endif /* WOF_WIDE_HEADER */
+
+#ifdef WOF_THREADS
+    int block;
+#endif /* WOF_THREADS */
+} wof_chunk_hdr_t;
+
+/* Handy macros for navigating the chunks in a block as if they were a
+ * doubly-linked list. */
+#define WOF_CHUNK_PREV(CHUNK) ((CHUNK)->prev \
+        ? ((wof_chunk_hdr_t*)(((unsigned char*)(CHUNK)) - (CHUNK)->prev)) \
+        : NULL)
+
+#define WOF_CHUNK_NEXT(CHUNK) ((CHUNK)->last \
+        ? NULL \
+        : ((wof_chunk_hdr_t*)(((unsigned char*)(CHUNK)) + (CHUNK)->len)))
+
+#define WOF_CHUNK_HEADER_SIZE WOF_ALIGN_SIZE(sizeof(wof_chunk_hdr_t))
+
+/* other handy chunk macros */
+#define WOF_CHUNK_TO_DATA(CHUNK)  ((void*)((unsigned char*)(CHUNK) + WOF_CHUNK_HEADER_SIZE))
+#define WOF_DATA_TO_CHUNK(DATA)   ((wof_chunk_hdr_t*)((unsigned char*)(DATA) - WOF_CHUNK_HEADER_SIZE))
+#define WOF_CHUNK_DATA_LEN(CHUNK) ((CHUNK)->len - WOF_CHUNK_HEADER_SIZE)
+
+/* This is what the 'data' section of a chunk contains if it is free. */
+typedef struct _wof_free_hdr_t {
+    wof_chunk_hdr_t *prev, *next;
+} wof_free_hdr_t;
+
+/* Handy macro for accessing the free-header of a chunk */
+#define WOF_GET_FREE(CHUNK) ((wof_free_hdr_t*)WOF_CHUNK_TO_DATA(CHUNK))
+
+/* The size of the free header does not need to be aligned, as it is never used
+ * in any way that would affect the alignment of the memory returned from
+ * wof_alloc. This macro is defined just for consistency with all the other
+ * WOF_*_SIZE macros (which do need to be aligned). */
+#define WOF_FREE_HEADER_SIZE sizeof(wof_free_hdr_t)
+
+/* Requests of up to this many bytes are served by the small-object layer (when
+ * it is enabled) instead of by the chunk logic. */
+#define WOF_SMALL_MAX_SIZE 256
+
+/* The number of free_all cycles whose peak block usage wof_gc_policy looks
+ * back over. It sizes a field of the allocator struct, so anything including
+ * this header must agree on it. */
+#ifndef WOF_GC_WINDOW
+#define WOF_GC_WINDOW 16
+#endif
+
+/* The rest of these are only ever used through pointers outside of
+ * wof_allocator.c. */
+typedef struct _wof_block_hdr_t wof_block_hdr_t;
+typedef struct _wof_tlsf_t      wof_tlsf_t;
+typedef struct _wof_small_t     wof_small_t;
+#ifdef WOF_TRACE
+typedef struct _wof_trace_t     wof_trace_t;
+#endif /* WOF_TRACE */
+
+/* Blocks in the block list are kept in two runs: those initialized in the
+ * current epoch, followed by the stale ones that have not been touched since
+ * the last free_all. 'stale' points to the first of the latter (or is NULL),
+ * and is where wof_new_block looks before asking the OS for more memory.
+ * Jumbo blocks are kept in a list of their own, since they are never reused.
+ *
+ * With WOF_FLAG_TLSF_INDEX, tlsf is the index that replaces the recycler, and
+ * recycler_head is always NULL.
+ *
+ * nofree_arena is the used chunk that wof_alloc_nofree is currently carving
+ * objects into (see there), or NULL.
+ *
+ * marks is the stack of active marks, newest first, and marks_taken counts
+ * every mark ever taken, to stamp jumbo blocks with.
+ *
+ * With WOF_THREADS, remote_blocks is the list of our blocks that have chunks
+ * waiting on their remote lists. Other threads push onto it; we take the
+ * whole thing at once. */
+struct _wof_allocator_t {
+    wof_block_hdr_t *block_list;
+    wof_block_hdr_t *stale;
+    wof_block_hdr_t *jumbo_list;
+    wof_chunk_hdr_t *master_head;
+    wof_chunk_hdr_t *recycler_head;
+    wof_chunk_hdr_t *nofree_arena;
+    wof_tlsf_t      *tlsf;
+    wof_small_t     *small;
+    wof_mark_t      *marks;
+    unsigned long    marks_taken;
+    unsigned long    epoch;
+
+    size_t                    block_size;
+    size_t                    max_colour;
+    size_t                    next_colour;
+    const wof_block_source_t *source;
+    void                     *source_ctx;
+    const wof_block_hooks_t  *hooks;
+    void                     *hooks_ctx;
+
+    /* see wof_allocator_stats; the computed fields are not kept up to date */
+    wof_allocator_stats_t stats;
+    size_t                used_chunks;
+
+    /* ordinary blocks in the current epoch, the most there have been at once
+     * this epoch, and that peak for each of the last few epochs */
+    size_t                cur_blocks;
+    size_t                peak_blocks;
+    size_t                peaks[WOF_GC_WINDOW];
+#ifdef WOF_THREADS
+    wof_block_hdr_t *remote_blocks;
+#endif /* WOF_THREADS */
+#ifdef WOF_TRACE
+    wof_trace_t     *trace;
+#endif /* WOF_TRACE */
+};
+
+/* Allocates like wof_alloc, but handles the common case (an ordinary request
+ * that the head of the recycler or of the master stack can be split to serve)
+ * without a call. Anything else, including a request that would use up the
+ * whole of the chunk it is served from, goes to wof_alloc. */
+WOF_INLINE void *
+wof_alloc_inline(wof_allocator_t *allocator, const size_t size)
+{
+    wof_chunk_hdr_t *chunk, *extra, *head;
+    wof_free_hdr_t  *old_blk, *new_blk;
+    unsigned long   *hits;
+    size_t           len, available;
+    int              last;
+
+    if (size == 0 || allocator->tlsf ||
+            (allocator->small && size <= WOF_SMALL_MAX_SIZE &&
+             !allocator->marks)) {
+        return wof_alloc(allocator, size);
+    }
+#ifdef WOF_TRACE
+    if (allocator->trace) {
+        return wof_alloc(allocator, size);
+    }
+#endif /* WOF_TRACE */
+#ifdef WOF_THREADS
+    if (__atomic_load_n(&allocator->remote_blocks, __ATOMIC_ACQUIRE)) {
+        return wof_alloc(allocator, size);
+    }
+#endif /* WOF_THREADS */
+
+    /* pick the chunk the same way wof_alloc would */
+    chunk = allocator->recycler_head;
+    if (chunk && !allocator->marks &&
+            (size_t)WOF_CHUNK_DATA_LEN(chunk) >= size) {
+        hits = &allocator->stats.recycler_hits;
+    }
+    else {
+        chunk = allocator->master_head;
+        hits = &allocator->stats.master_hits;
+    }
+
+    /* and make sure it splits, without overflowing on a huge size */
+    if (chunk == NULL || size >= (size_t)chunk->len ||
+            (size_t)WOF_CHUNK_DATA_LEN(chunk) < WOF_ALIGN_SIZE(size)
+                + WOF_CHUNK_HEADER_SIZE + WOF_FREE_HEADER_SIZE) {
+        return wof_alloc(allocator, size);
+    }
+
+    /* This is wof_split_free_chunk, less the cases we have ruled out. */
+    len       = WOF_ALIGN_SIZE(size) + WOF_CHUNK_HEADER_SIZE;
+    last      = chunk->last;
+    available = chunk->len - len;
+
+    chunk->len  = (int) len;
+    chunk->last = 0;
+    extra = WOF_CHUNK_NEXT(chunk);
+
+    old_blk = WOF_GET_FREE(chunk);
+    new_blk = WOF_GET_FREE(extra);
+
+    if (chunk == allocator->master_head) {
+        new_blk->prev = old_blk->prev;
+        new_blk->next = old_blk->next;
+        if (old_blk->next) {
+            WOF_GET_FREE(old_blk->next)->prev = extra;
+        }
+        allocator->master_head = extra;
+    }
+    else {
+        if (old_blk->prev == chunk) {
+            new_blk->prev = extra;
+            new_blk->next = extra;
+        }
+        else {
+            new_blk->prev = old_blk->prev;
+            new_blk->next = old_blk->next;
+            WOF_GET_FREE(old_blk->prev)->next = extra;
+            WOF_GET_FREE(old_blk->next)->prev = extra;
+        }
+        allocator->recycler_head = extra;
+    }
+
+    extra->len   = (int) available;
+    extra->last  = last;
+    extra->prev  = chunk->len;
+    extra->used  = 0;
+    extra->jumbo = 0;
+#ifdef WOF_THREADS
+    extra->block = chunk->block + chunk->len;
+#endif /* WOF_THREADS */
+
+    if (!last) {
+        WOF_CHUNK_NEXT(extra)->prev = extra->len;
+    }
+
+    /* This is wof_cycle_recycler. */
+    head = allocator->recycler_head;
+    if (head) {
+        old_blk = WOF_GET_FREE(head);
+        if (old_blk->next->len < head->len) {
+            WOF_GET_FREE(old_blk->next)->prev = old_blk->prev;
+            WOF_GET_FREE(old_blk->prev)->next = old_blk->next;
+
+            old_blk->prev = old_blk->next;
+            old_blk->next = WOF_GET_FREE(old_blk->next)->next;
+
+            WOF_GET_FREE(old_blk->next)->prev = head;
+            WOF_GET_FREE(old_blk->prev)->next = head;
+        }
+        else {
+            allocator->recycler_head = old_blk->next;
+        }
+    }
+
+    chunk->used = -1; /* a one-bit signed field's 'true' */
+    allocator->used_chunks++;
+    allocator->stats.bytes_requested += size;
+    allocator->stats.bytes_in_use += chunk->len;
+    (*hits)++;
+
+    WOF_PROBE3(alloc, allocator, WOF_CHUNK_TO_DATA(chunk), size);
+
+    return WOF_CHUNK_TO_DATA(chunk);
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __WOF_ALLOCATOR_INLINE_H__ */